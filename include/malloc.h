@@ -22,6 +22,100 @@
 
 # define ALIGNMENT 16
 # define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+# define MAX_ALLOC_SIZE (SIZE_MAX >> 2)     // Larger requests fail instead of wrapping around
+
+/* TINY slabs: each TINY zone serves a single size class, carved into equal slots */
+# define TINY_CLASSES       16      // 16..128 by 16, 160..256 by 32, 320..512 by 64
+# define SLAB_MIN_SLOTS     100     // Slab zones grow (by powers of two) to fit this many slots
+# define SLAB_MAX_SLOTS     1024    // Size of the per-slab live bitmap
+
+/* Empty zones: up to MALLOC_SPARE_ZONES are kept per class and arena, the rest are unmapped */
+# define ZONE_CLASSES       (TINY_CLASSES + 1)
+# define SMALL_ZONE_CLASS   TINY_CLASSES
+# define DEFAULT_SPARE_ZONES 1
+
+/* Hugepage chunks: zones are carved from 2 MiB aligned chunks marked MADV_HUGEPAGE */
+# define CHUNK_SIZE         (2UL * 1024 * 1024)
+# define CHUNK_UNIT         ((size_t)TINY_ZONE_SIZE)    // Zones take power-of-two runs of units
+# define CHUNK_MAX_UNITS    128                 // Units per chunk with 4 KiB pages
+# define CHUNK_PURGE_RATIO  4       // Below 1/4 used, free units are handed back to the OS
+# define SPARE_CHUNKS       1       // Empty chunks kept mapped
+
+/* Address space reservation: chunks are committed inside one PROT_NONE range */
+# define DEFAULT_RESERVE    (64UL << 30)    // MALLOC_RESERVE, 0 maps every chunk on its own
+# define RESERVE_MAX_CHUNKS (DEFAULT_RESERVE / CHUNK_SIZE)
+
+/* SMALL free lists: 4 bins per power of two, from 16 bytes up */
+# define SMALL_BINS         64
+
+/* Page map entry kinds, stored in the low bits of the owner address */
+# define PAGE_TINY          1       // Owner is a TINY slab (t_zone)
+# define PAGE_SMALL         2       // Owner is a SMALL zone (t_zone)
+# define PAGE_LARGE         3       // Owner is a LARGE mapping (its t_large header)
+# define PAGEMAP_KIND(e)    ((int)((e) & 3))
+# define PAGEMAP_OWNER(e)   ((void *)((e) & ~(uintptr_t)3))
+
+/* SMALL blocks: 8-byte headers, neighbours found by address arithmetic */
+# define BLOCK_DATA(b)      ((void *)((char *)(b) + sizeof(t_block)))
+# define BLOCK_OF(ptr)      ((t_block *)((char *)(ptr) - sizeof(t_block)))
+# define NEXT_BLOCK(b)      ((t_block *)((char *)(b) + (b)->size))
+# define BLOCK_SIZE(n)      ALIGN((n) + sizeof(t_block))    // Block holding n user bytes
+# define MIN_BLOCK          ALIGN(sizeof(t_block) + sizeof(t_free_links))
+
+/* Arenas: independent zone lists and locks, threads are spread across them */
+# define MAX_ARENAS             64
+# define ARENA_CONTENTION_LIMIT 16  // Contended locks in a row before switching arena
+
+/* Thread cache: recently freed TINY/SMALL blocks, one bin per aligned size */
+# define TCACHE_BINS        (BLOCK_SIZE(SMALL_MAX) / ALIGNMENT + 1)
+# define TCACHE_BIN_MAX     32      // Blocks kept per bin before flushing
+# define TCACHE_FLUSH_BATCH 16      // Blocks returned to the heap per flush
+# define TCACHE_UNINIT      0
+# define TCACHE_ACTIVE      1
+# define TCACHE_DEAD        2       // Thread is exiting, bypass the cache
+
+/* LARGE cache: freed mappings kept per arena for reuse, binned by page count */
+# define LARGE_CACHE_BINS       48      // 4 bins per power of two, up to 4096 pages
+# define DEFAULT_LARGE_CACHE    (16UL * 1024 * 1024)    // Bytes retained per arena
+# define DEFAULT_LARGE_CACHE_AGE 10     // Seconds before an idle mapping is unmapped
+
+/* calloc: dirty LARGE regions this big are zeroed by dropping their pages */
+# define CALLOC_MADVISE_MIN     (256 * 1024)
+
+/* ft_memcpy/ft_memset: copies and fills this big bypass the cache */
+# define MEMOPS_STREAM_MIN      (1024 * 1024)
+
+/* Statistics: counters per TINY class, per 512-byte range of SMALL usable sizes, and for LARGE */
+# define STAT_SMALL_STEP    512
+# define STAT_SMALL_CLASSES (SMALL_MAX / STAT_SMALL_STEP + 1)
+# define STAT_LARGE_CLASS   (TINY_CLASSES + STAT_SMALL_CLASSES)
+# define STAT_CLASSES       (STAT_LARGE_CLASS + 1)
+# define STATS_UNINIT       0
+# define STATS_ACTIVE       1
+# define STATS_DEAD         2       // Thread is exiting, count in the retired totals
+
+/* Heap profiler: a stack is recorded about every MALLOC_PROFILE_RATE bytes allocated */
+# define DEFAULT_PROFILE_RATE   (512 * 1024)
+# define PROFILE_MAX_DEPTH      32
+# define PROFILE_SKIP           2       // profile_alloc() and heap_alloc()
+# define PROFILE_BUCKETS        4096    // Hash heads of distinct stacks
+# define PROFILE_LIVE_SLOTS     8192    // Hash heads of sampled live blocks
+# define PROFILE_POOL_SIZE      (1024 * 1024)   // Profiler memory is mapped this much at a time
+
+/* Allocation trace: each thread encodes its calls in a buffer written out when full */
+# define TRACE_MAGIC            "FTMTRACE"
+# define TRACE_VERSION          1
+# define TRACE_BUFFER_SIZE      (64 * 1024)
+# define TRACE_EVENT_MAX        64      // Largest encoded event
+# define TRACE_MALLOC           0
+# define TRACE_CALLOC           1
+# define TRACE_ALIGNED          2
+# define TRACE_REALLOC          3
+# define TRACE_FREE             4
+# define TRACE_NULL             0x80    // Op flag: the call returned NULL
+# define TRACE_UNINIT           0
+# define TRACE_ACTIVE           1
+# define TRACE_DEAD             2       // Thread is exiting, write straight to the file
 
 /* Debug environment variables */
 # define MALLOC_SCRIBBLE_FREE 0xDE
@@ -31,7 +125,7 @@
 typedef struct s_alloc_history {
     void            *ptr;
     size_t          size;
-    time_t          timestamp;
+    uint64_t        timestamp;       // heap_clock() milliseconds
     bool            is_freed;
     struct s_alloc_history *next;
 } t_alloc_history;
@@ -44,25 +138,235 @@ typedef struct s_debug_flags {
     int             check_level;     // MALLOC_CHECK_ (0-3)
 } t_debug_flags;
 
+/*
+    * Header of a SMALL block, right before its user area. Blocks of a zone
+    * are laid out back to back up to a zero-sized fence at the end of the
+    * zone, so the next block is at block + size and the previous one at
+    * block - prev_size. TINY slots have no header at all.
+    * in_tcache is written without the arena lock, it has a byte of its own.
+*/
 typedef struct s_block {
-    size_t          size;
-    bool             is_free;
-    struct s_block  *next;
-    time_t          alloc_time;      // For history tracking
+    uint32_t        size;            // Bytes of the block, header included, 0 for the fence
+    uint32_t        prev_size : 23;  // Previous block's size in ALIGNMENT units, 0 for the first
+    uint32_t        is_free : 1;
+    bool            in_tcache;       // Parked in a thread cache or remote-free queue, still owned by the zone
 } t_block;
 
+/* Header of a LARGE mapping, right before the user area in its first page */
+typedef struct s_large {
+    size_t          size;
+    uint32_t        pages;           // Length of the mapping in pages
+    uint8_t         arena;           // Index of the owning arena in g_heap.arenas
+    bool            sampled;         // Recorded by the heap profiler
+    struct s_large  *next;           // Chains mappings waiting to be unmapped
+} t_large;
+
+/* Links of a free SMALL block, stored in its user area */
+typedef struct s_free_links {
+    t_block         *prev;
+    t_block         *next;
+} t_free_links;
+
+/* Links of a cached LARGE mapping, stored in its user area */
+typedef struct s_cached_large {
+    t_large         *bin_prev;
+    t_large         *bin_next;
+    t_large         *newer;
+    t_large         *older;
+    uint64_t        released;        // heap_clock() milliseconds
+} t_cached_large;
+
 typedef struct s_zone {
     size_t          size;
     struct s_zone   *next;
-    t_block         *blocks;
+    struct s_zone   *prev;
+    t_block         *blocks;         // SMALL: first block
+    size_t          used;            // Blocks currently allocated (thread caches included)
+    char            *clean;          // Nothing past this was handed out since the zone was mapped
+    size_t          size_class;      // TINY class, SMALL_ZONE_CLASS for SMALL zones
+    uint8_t         arena;           // Index of the owning arena in g_heap.arenas
+    size_t          sampled;         // Live blocks recorded by the heap profiler, updated atomically
+    /* TINY slabs only */
+    size_t          capacity;        // Slots that fit in the zone
+    size_t          carved;          // Slots handed out at least once (bump pointer)
+    void            *free_slots;     // Freed slots, linked through their first bytes
+    struct s_zone   *avail_prev;     // Zones of this class with a slot left
+    struct s_zone   *avail_next;
+    uint64_t        live[SLAB_MAX_SLOTS / 64];  // Slots held by the user, updated atomically
 } t_zone;
 
-typedef struct s_heap {
+/* Header of a hugepage chunk, in its first unit */
+typedef struct s_chunk {
+    struct s_chunk  *next;
+    struct s_chunk  *prev;
+    uint64_t        used[CHUNK_MAX_UNITS / 64];     // Units holding a zone (unit 0: this header)
+    uint64_t        dirty[CHUNK_MAX_UNITS / 64];    // Free units still backed by used memory
+    size_t          used_units;
+} t_chunk;
+
+typedef struct s_tcache {
+    void            *bins[TCACHE_BINS];
+    uint16_t        counts[TCACHE_BINS];
+    int             state;           // TCACHE_UNINIT / TCACHE_ACTIVE / TCACHE_DEAD
+} t_tcache;
+
+typedef struct s_arena {
     t_zone              *tiny;
     t_zone              *small;
-    t_block             *large;
+    t_zone              *tiny_avail[TINY_CLASSES];  // Slabs with a free or uncarved slot
+    t_block             *small_bins[SMALL_BINS];    // Free SMALL blocks by size range
+    uint64_t            small_binmap;               // Bit i set when small_bins[i] is not empty
+    size_t              empty_zones[ZONE_CLASSES];  // Zones with no block in use, per class
+    t_large             *large_bins[LARGE_CACHE_BINS];  // Cached LARGE mappings by page count
+    t_large             *large_newest;   // Cached mappings in release order
+    t_large             *large_oldest;
+    size_t              large_cached;    // Bytes held by the LARGE cache
     pthread_mutex_t     mutex;
+    void                *remote_frees;   // Blocks freed while the arena was busy, pushed lock-free
+    uint8_t             index;
+    size_t              threads;         // Threads currently bound to this arena
+} t_arena;
+
+typedef struct s_heap_stats {
+    size_t              zones_released;  // Empty TINY/SMALL zones given back to the OS
+    size_t              bytes_released;
+    size_t              large_hits;      // LARGE requests served from the cache
+    size_t              large_misses;    // LARGE requests that needed a new mapping
+    size_t              chunks;          // Hugepage chunks currently mapped
+    size_t              chunk_purges;    // Times free units of a mostly empty chunk were dropped
+    size_t              mmap_calls;      // mmap and mremap calls made by the allocator
+    size_t              munmap_calls;
+    size_t              bytes_mapped;    // Read/write bytes currently mapped or committed
+    size_t              large_mapped;    // Part of it held by LARGE mappings, cached ones included
+    size_t              large_mmaps;     // LARGE mappings created
+    size_t              large_munmaps;
+    size_t              zones_created;
+    size_t              pagemap_bytes;   // Page map nodes, never released
+} t_heap_stats;
+
+/*
+    * Allocation counters of one thread, written by it alone with plain
+    * stores. Live threads are chained so the counters can be summed.
+*/
+typedef struct s_thread_stats {
+    size_t                  allocs[STAT_CLASSES];
+    size_t                  frees[STAT_CLASSES];
+    size_t                  bytes_allocated[STAT_CLASSES];  // Usable bytes
+    size_t                  bytes_freed[STAT_CLASSES];
+    struct s_thread_stats   *next;
+    struct s_thread_stats   *prev;
+    int                     state;   // STATS_UNINIT / STATS_ACTIVE / STATS_DEAD
+} t_thread_stats;
+
+/* One size class in malloc_get_stats() */
+typedef struct s_class_stats {
+    size_t          size;            // Largest usable size of the class, 0 for LARGE
+    size_t          allocs;
+    size_t          frees;
+    size_t          bytes_allocated;
+    size_t          bytes_freed;
+} t_class_stats;
+
+/* Allocations sampled with one call stack */
+typedef struct s_prof_bucket {
+    struct s_prof_bucket    *next;
+    uint64_t                hash;
+    size_t                  allocs;
+    size_t                  alloc_bytes;
+    size_t                  frees;
+    size_t                  free_bytes;
+    int                     depth;
+    void                    *frames[PROFILE_MAX_DEPTH];
+} t_prof_bucket;
+
+/* A sampled block the user still holds */
+typedef struct s_prof_sample {
+    struct s_prof_sample    *next;
+    void                    *ptr;
+    size_t                  size;
+    t_prof_bucket           *bucket;
+} t_prof_sample;
+
+/* Start of a trace file, chunks follow */
+typedef struct s_trace_header {
+    char            magic[8];        // TRACE_MAGIC, not terminated
+    uint32_t        version;
+    uint32_t        reserved;
+} t_trace_header;
+
+/* Events of one thread, their deltas continue from the thread's previous chunk */
+typedef struct s_trace_chunk {
+    uint32_t        thread;
+    uint32_t        length;          // Bytes of encoded events that follow
+} t_trace_chunk;
+
+/* Snapshot filled by malloc_get_stats() */
+typedef struct s_malloc_stats {
+    t_class_stats   classes[STAT_CLASSES];
+    size_t          allocs;
+    size_t          frees;
+    size_t          bytes_in_use;    // Usable bytes held by the user
+    size_t          bytes_mapped;    // Zones, chunks, LARGE mappings and the page map
+    size_t          large_mapped;
+    size_t          metadata;        // Headers and page map, an estimate
+    size_t          zones_created;
+    size_t          zones_released;
+    size_t          large_mmaps;
+    size_t          large_munmaps;
+    size_t          large_cache_hits;
+    size_t          large_cache_misses;
+    size_t          mmap_calls;
+    size_t          munmap_calls;
+} t_malloc_stats;
+
+/* One TINY or SMALL zone in malloc_zone_info(), thread caches count as free */
+typedef struct s_zone_info {
+    void            *start;
+    size_t          size;            // Bytes mapped for the zone
+    int             kind;            // PAGE_TINY or PAGE_SMALL
+    size_t          slot_size;       // TINY slot size, 0 for SMALL
+    size_t          used_bytes;
+    size_t          free_bytes;      // Free blocks and TINY slots never handed out
+    size_t          free_blocks;
+    size_t          largest_free;    // Largest request the zone could serve
+} t_zone_info;
+
+/* glibc's mallinfo2(), filled from the same counters */
+struct mallinfo2 {
+    size_t          arena;           // Bytes mapped for TINY/SMALL zones
+    size_t          ordblks;
+    size_t          smblks;
+    size_t          hblks;           // LARGE blocks in use
+    size_t          hblkhd;          // Bytes mapped for LARGE blocks
+    size_t          usmblks;
+    size_t          fsmblks;
+    size_t          uordblks;        // TINY/SMALL bytes in use
+    size_t          fordblks;        // The rest of the zone bytes
+    size_t          keepcost;
+};
+
+typedef struct s_heap {
+    t_arena             arenas[MAX_ARENAS];
+    size_t              arena_count;     // MALLOC_ARENAS, defaults to the CPU count
+    pthread_mutex_t     mutex;           // Guards the history buffer
+    pthread_mutex_t     chunk_mutex;     // Guards the chunk list
+    t_chunk             *chunks;         // Hugepage chunks, zones are carved from them
+    bool                hugepages;       // MALLOC_HUGEPAGES, on unless set to 0
+    char                *reserve;        // PROT_NONE range chunks are committed in, or NULL
+    size_t              reserve_size;    // MALLOC_RESERVE, in bytes
+    uint64_t            reserve_used[RESERVE_MAX_CHUNKS / 64];  // Committed chunk slots
     t_debug_flags       debug;
+    bool                tcache_enabled;  // Off when MALLOC_TCACHE=0 or a debug mode is on
+    size_t              spare_zones;     // MALLOC_SPARE_ZONES, empty zones kept per class
+    size_t              large_cache_max; // MALLOC_LARGE_CACHE, bytes retained per arena
+    time_t              large_cache_age; // MALLOC_LARGE_CACHE_AGE, in seconds
+    size_t              profile_rate;    // MALLOC_PROFILE_RATE, 0 while the profiler is off
+    const char          *profile_path;   // MALLOC_PROFILE, the profile is written there at exit
+    bool                tracing;         // Calls are being recorded to a trace file
+    const char          *trace_path;     // MALLOC_TRACE, the trace goes to <path>.<pid>.trace
+    t_heap_stats        stats;
+    uint64_t            clock_base;      // heap_clock() at heap_init()
+    uint64_t            wall_base;       // Wall clock at heap_init(), in milliseconds
     t_alloc_history     history_buffer[MAX_ALLOC_HISTORY];  // Buffer statique
     size_t              history_count;
 } t_heap;
@@ -81,6 +385,20 @@ void *malloc(size_t size);
 */
 void free(void *ptr);
 
+/*
+    * Sized free (C23)
+    * The caller passes back the requested size, which picks the block's class
+    * without the ownership checks of free(). MALLOC_CHECK_ cross-checks it.
+*/
+void free_sized(void *ptr, size_t size);
+void free_aligned_sized(void *ptr, size_t alignment, size_t size);
+
+/*
+    * Usable size
+    * Bytes actually available behind an allocated pointer
+*/
+size_t malloc_usable_size(void *ptr);
+
 /*
     * Reallocating memory
     * This function is responsible for resizing allocated memory blocks
@@ -88,41 +406,222 @@ void free(void *ptr);
 void *realloc(void *ptr, size_t size);
 
 /* Helper functions */
-t_block *allocate_block(size_t size);
 t_zone  *create_zone(size_t zone_size);
-void    *allocate_large(size_t size);
+void    link_zone(t_zone **list, t_zone *zone);
+bool    zone_emptied(t_arena *arena, size_t zone_class);
+void    unmap_zone(t_zone **list, t_zone *zone);
+void    *map_aligned(size_t size, size_t alignment);
+
+/*
+    * Zone backend
+    * Maps TINY/SMALL zones aligned to their size, packed into hugepage chunks.
+    * zeroed tells whether the memory is still as mmap left it.
+    * smaps_thp_bytes() reads an smaps listing, chunk_thp_bytes() the process's.
+*/
+void    *zone_map(size_t size, bool *zeroed);
+void    zone_unmap(void *zone, size_t size);
+size_t  smaps_thp_bytes(int fd);
+size_t  chunk_thp_bytes(void);
 
 /*
-    * Memory management functions
-    * These functions are responsible for finding, allocating, and managing memory blocks
+    * Virtual memory
+    * Every mapping of the allocator goes through os_map/os_unmap, which count
+    * the system calls. Chunks are committed in the reserved range when it has
+    * room, vm_contains() tells whether an address lies in it.
 */
-t_block *find_free_block(t_zone *zone, size_t size);
+void    vm_reserve(void);
+void    *vm_commit(void);
+bool    vm_release(void *chunk);
+bool    vm_contains(const void *addr);
+size_t  vm_mappings(void);
+void    *os_map(size_t size);
+void    os_unmap(void *addr, size_t size);
+
+/*
+    * Clock
+    * Cheap coarse monotonic stamps, in milliseconds, for the debug history and
+    * the LARGE cache; heap_wall_time() converts one to wall time for display.
+*/
+void    heap_clock_init(void);
+uint64_t heap_clock(void);
+time_t  heap_wall_time(uint64_t stamp);
+
+void    *allocate_large(t_arena *arena, size_t size, size_t alignment, size_t *dirty);
+
+/*
+    * LARGE cache
+    * Freed LARGE mappings are retained for reuse, the owning arena must be
+    * locked. Mappings returned by large_cache_put are unmapped by
+    * large_cache_unmap once the lock is released, large_cache_trim unmaps
+    * the expired ones right away.
+*/
+t_large *large_cache_take(t_arena *arena, size_t pages);
+t_large *large_cache_put(t_arena *arena, t_large *large);
+void    large_cache_trim(t_arena *arena);
+void    large_cache_unmap(t_large *chain);
+
+/*
+    * Page map
+    * Constant-time lookup of the zone or LARGE mapping owning an address
+*/
+bool        pagemap_set(void *start, size_t len, void *owner, int kind);
+void        pagemap_clear(void *start, size_t len);
+uintptr_t   pagemap_get(const void *addr);
+void        *pagemap_next(int kind, const void *after);
+
+/*
+    * Arenas
+    * heap_init() runs once per process, arena_lock() returns the calling
+    * thread's arena with its mutex held
+*/
+void    heap_init(void);
+t_arena *arena_lock(void);
+t_arena *arena_of(t_zone *zone);
+
+/*
+    * Remote frees
+    * A thread that finds a block's arena locked queues the block instead of
+    * waiting; whoever holds the lock next releases the queue in one batch.
+*/
+void    remote_free(t_arena *arena, void *ptr);
+void    drain_remote_frees(t_arena *arena);
+
 /*
     * Block splitting
-    * This function is responsible for splitting a block into two smaller blocks
+    * Cuts a SMALL block down to size bytes (header included), returns the free tail
 */
 t_block *split_block(t_block *block, size_t size);
 /*
     * Block merging
     * This function is responsible for merging adjacent free blocks into a larger block
 */
-void    merge_blocks(t_block *block);
+void    merge_blocks(t_arena *arena, t_block *block);
+t_block *prev_block(t_block *block);
+/*
+    * Block release
+    * Returns a TINY/SMALL block to its zone, the owning arena must be locked
+*/
+void    release_block(t_zone *zone, void *ptr);
+/*
+    * Block resizing
+    * Grows a SMALL block into a free neighbour or splits off its tail in place
+*/
+bool    resize_block(t_zone *zone, t_block *block, size_t size);
+
+/*
+    * SMALL bins
+    * Segregated free lists, only free blocks are ever visited
+*/
+size_t  small_bin(size_t size);
+void    bin_insert(t_arena *arena, t_block *block);
+void    bin_remove(t_arena *arena, t_block *block);
+t_block *bin_take(t_arena *arena, size_t size);
+
+/*
+    * TINY slabs
+    * O(1) allocation and free of size-classed, header-less slots. A live bit
+    * per slot tracks whether the user holds it.
+*/
+size_t  tiny_class(size_t size);
+size_t  tiny_class_size(size_t size_class);
+size_t  tiny_aligned_class(size_t size, size_t alignment);
+void    *allocate_slab(t_arena *arena, size_t size_class, size_t *dirty);
+void    slab_free(t_zone *zone, void *ptr);
+bool    slot_release(t_zone *zone, void *ptr);
+void    slot_reuse(void *ptr, size_t size_class);
+void    *live_slot(t_zone *zone, size_t index);
+
+/*
+    * Allocators
+    * dirty receives how many bytes at the start of the user area may hold old
+    * data, the rest is known to be zero (calloc skips it)
+*/
+void *allocate_from_zone(t_arena *arena, t_zone **zone, size_t size, size_t zone_size, size_t *dirty);
+void *allocate_aligned_from_zone(t_arena *arena, size_t size, size_t alignment, size_t *dirty);
+void *heap_alloc(size_t size, size_t *dirty);
+void *heap_alloc_aligned(size_t size, size_t alignment, size_t *dirty);
+void heap_free(void *ptr);
 
-void *allocate_from_zone(t_zone **zone, size_t size, size_t zone_size);
+/*
+    * Thread cache
+    * Lock-free fast path in front of the arena mutexes for TINY/SMALL blocks
+*/
+void    *tcache_get(size_t size);
+bool    tcache_put(void *ptr, size_t size);
 
 /* Introspection/visualization */
 void show_alloc_mem(void);
 void show_alloc_mem_ex(void);
+size_t malloc_zone_info(t_zone_info *zones, size_t max);
+
+/*
+    * Statistics
+    * stats_alloc()/stats_free() take the page kind and usable size of a block
+    * and only touch the calling thread's counters. Reading sums all threads
+    * under a mutex, it never stops an allocation.
+*/
+void    stats_alloc(int kind, size_t usable);
+void    stats_free(int kind, size_t usable);
+size_t  large_usable(t_large *large, void *ptr);
+void    malloc_get_stats(t_malloc_stats *stats);
+struct mallinfo2 mallinfo2(void);
+void    malloc_stats(void);
+
+/*
+    * Heap profiler
+    * profile_alloc() is only called while profile_rate is set, the free
+    * side only when the zone or LARGE mapping holds a sampled block.
+*/
+void    profile_alloc(void *ptr, size_t size, int kind);
+bool    profile_free(void *ptr);
+void    profile_move(void *old_ptr, void *new_ptr, size_t size);
+void    malloc_profile_set_rate(size_t rate);
+int     malloc_profile_dump(const char *path);
+bool    pid_path(char *dst, size_t cap, const char *base, const char *suffix);
+
+/*
+    * Allocation trace
+    * The public entry points record their calls while tracing is set, the
+    * internal paths (heap_alloc, heap_free) do not: realloc() is one event.
+*/
+void    trace_init(void);
+uint64_t trace_clock(void);
+void    trace_alloc(int op, void *ptr, size_t size, size_t alignment);
+void    trace_realloc(void *old_ptr, void *new_ptr, size_t size, uint64_t start);
+void    trace_free(void *ptr);
+int     malloc_trace_start(const char *path);
+void    malloc_trace_stop(void);
 
 /* Debug functions */
 void init_debug_flags(void);
 void add_to_history(void *ptr, size_t size, bool is_alloc);
 void scribble_memory(void *ptr, size_t size, unsigned char pattern);
 void check_guards(void *ptr);
-void defragment_zones(void);
+void defragment_zones(t_arena *arena);
 
 /* Public API for defragmentation */
 void malloc_defragment(void);
 
+/*
+    * Zeroed allocation
+    * Only the bytes that may hold old data are cleared
+*/
+void *calloc(size_t nmemb, size_t size);
+
+/*
+    * Aligned allocation
+    * Results are freed and reallocated like any other block
+*/
+int  posix_memalign(void **memptr, size_t alignment, size_t size);
+void *aligned_alloc(size_t alignment, size_t size);
+void *memalign(size_t alignment, size_t size);
+void *valloc(size_t size);
+void *pvalloc(size_t size);
+
+/*
+    * Copy and fill kernels, vectorized with runtime dispatch (memops.c)
+    * Used for realloc copies, calloc zeroing and scribbling
+*/
 void *ft_memcpy(void *dest, const void *src, size_t n);
+void *ft_memset(void *dest, int c, size_t n);
 #endif
\ No newline at end of file
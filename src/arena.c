@@ -0,0 +1,156 @@
+#include "../include/malloc.h"
+#include <sched.h>
+
+/*
+    * Arena selection.
+    * Each thread is bound to one arena the first time it allocates, picking
+    * the one with the fewest bound threads. If the thread keeps finding its
+    * arena locked it moves to the least loaded one. Zones and LARGE mappings
+    * remember their arena so free() always goes back to the owner, whoever
+    * calls it.
+*/
+
+static __thread t_arena *g_thread_arena __attribute__((tls_model("initial-exec")));
+static __thread unsigned g_contention __attribute__((tls_model("initial-exec")));
+
+static pthread_once_t   g_heap_once = PTHREAD_ONCE_INIT;
+static pthread_key_t    g_arena_key;
+
+static size_t default_arena_count(void)
+{
+    cpu_set_t   set;
+    char        *env;
+    long        count;
+
+    env = getenv("MALLOC_ARENAS");
+    if (env && (count = atol(env)) > 0)
+        return count > MAX_ARENAS ? MAX_ARENAS : (size_t)count;
+
+    // sched_getaffinity is a plain syscall, sysconf() may allocate
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+        count = CPU_COUNT(&set);
+    else
+        count = 1;
+    return count > MAX_ARENAS ? MAX_ARENAS : (size_t)count;
+}
+
+static void arena_thread_exit(void *arg)
+{
+    t_arena *arena = (t_arena *)arg;
+
+    __atomic_fetch_sub(&arena->threads, 1, __ATOMIC_RELAXED);
+}
+
+static void heap_init_once(void)
+{
+    init_debug_flags();
+    heap_clock_init();
+    trace_init();
+    vm_reserve();
+
+    g_heap.arena_count = default_arena_count();
+    for (size_t i = 0; i < g_heap.arena_count; i++)
+    {
+        pthread_mutex_init(&g_heap.arenas[i].mutex, NULL);
+        g_heap.arenas[i].index = (uint8_t)i;
+    }
+    pthread_key_create(&g_arena_key, arena_thread_exit);
+}
+
+void heap_init(void)
+{
+    pthread_once(&g_heap_once, heap_init_once);
+}
+
+static t_arena *least_loaded_arena(void)
+{
+    t_arena *best = &g_heap.arenas[0];
+
+    for (size_t i = 1; i < g_heap.arena_count; i++)
+    {
+        if (__atomic_load_n(&g_heap.arenas[i].threads, __ATOMIC_RELAXED)
+            < __atomic_load_n(&best->threads, __ATOMIC_RELAXED))
+            best = &g_heap.arenas[i];
+    }
+    return best;
+}
+
+static void bind_arena(t_arena *arena)
+{
+    if (g_thread_arena)
+        __atomic_fetch_sub(&g_thread_arena->threads, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&arena->threads, 1, __ATOMIC_RELAXED);
+    g_thread_arena = arena;
+    g_contention = 0;
+    pthread_setspecific(g_arena_key, arena);
+}
+
+t_arena *arena_lock(void)
+{
+    t_arena *arena;
+
+    if (!g_thread_arena)
+        bind_arena(least_loaded_arena());
+    arena = g_thread_arena;
+
+    if (pthread_mutex_trylock(&arena->mutex) == 0)
+    {
+        g_contention = 0;
+        drain_remote_frees(arena);
+        return arena;
+    }
+
+    // Contended: after enough misses in a row, try a quieter arena
+    if (++g_contention >= ARENA_CONTENTION_LIMIT && g_heap.arena_count > 1)
+    {
+        t_arena *candidate = least_loaded_arena();
+
+        if (candidate != arena)
+        {
+            bind_arena(candidate);
+            arena = candidate;
+        }
+        g_contention = 0;
+    }
+    pthread_mutex_lock(&arena->mutex);
+    drain_remote_frees(arena);
+    return arena;
+}
+
+t_arena *arena_of(t_zone *zone)
+{
+    return &g_heap.arenas[zone->arena];
+}
+
+#define REMOTE_NEXT(ptr) (*(void **)(ptr))
+
+/*
+    * Multi-producer stack: any thread pushes with a CAS, only the lock holder
+    * takes the whole list at once with an exchange, so there is no ABA.
+*/
+void remote_free(t_arena *arena, void *ptr)
+{
+    void *head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+
+    do
+        REMOTE_NEXT(ptr) = head;
+    while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, ptr, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Release the queued blocks, the arena must be locked */
+void drain_remote_frees(t_arena *arena)
+{
+    void *ptr;
+    void *next;
+
+    if (!__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED))
+        return;
+    ptr = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (ptr)
+    {
+        next = REMOTE_NEXT(ptr);
+        release_block(PAGEMAP_OWNER(pagemap_get(ptr)), ptr);
+        ptr = next;
+    }
+}
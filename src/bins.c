@@ -0,0 +1,76 @@
+#include "../include/malloc.h"
+
+/*
+    * Segregated free lists for SMALL zones.
+    * Free blocks are kept in doubly linked lists, one per size range, with
+    * the links stored in the block's user area. Each power of two is split in
+    * 4 bins, and a bitmap tells which bins are non-empty so a request goes
+    * straight to the first bin that can hold it.
+*/
+
+#define LINKS(block) ((t_free_links *)((char *)(block) + sizeof(t_block)))
+
+size_t small_bin(size_t size)
+{
+    size_t exp = 63 - __builtin_clzl(size);
+    size_t bin;
+
+    if (exp < 4)
+        return 0;
+    bin = (exp - 4) * 4 + ((size >> (exp - 2)) & 3);
+    return bin < SMALL_BINS ? bin : SMALL_BINS - 1;
+}
+
+void bin_insert(t_arena *arena, t_block *block)
+{
+    size_t bin = small_bin(block->size);
+    t_block *head = arena->small_bins[bin];
+
+    LINKS(block)->prev = NULL;
+    LINKS(block)->next = head;
+    if (head)
+        LINKS(head)->prev = block;
+    arena->small_bins[bin] = block;
+    arena->small_binmap |= 1UL << bin;
+}
+
+void bin_remove(t_arena *arena, t_block *block)
+{
+    size_t bin = small_bin(block->size);
+    t_free_links *links = LINKS(block);
+
+    if (links->prev)
+        LINKS(links->prev)->next = links->next;
+    else
+        arena->small_bins[bin] = links->next;
+    if (links->next)
+        LINKS(links->next)->prev = links->prev;
+    if (!arena->small_bins[bin])
+        arena->small_binmap &= ~(1UL << bin);
+}
+
+/* Unlink and return a free block of at least size bytes, or NULL */
+t_block *bin_take(t_arena *arena, size_t size)
+{
+    size_t bin = small_bin(size);
+    uint64_t larger;
+    t_block *block;
+
+    // The request's own bin mixes smaller and larger blocks: first fit
+    for (block = arena->small_bins[bin]; block; block = LINKS(block)->next)
+    {
+        if (block->size >= size)
+        {
+            bin_remove(arena, block);
+            return block;
+        }
+    }
+
+    // Any block of a higher bin is large enough
+    larger = bin + 1 < SMALL_BINS ? arena->small_binmap & (~0UL << (bin + 1)) : 0;
+    if (!larger)
+        return NULL;
+    block = arena->small_bins[__builtin_ctzl(larger)];
+    bin_remove(arena, block);
+    return block;
+}
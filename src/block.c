@@ -1,75 +1,119 @@
 #include "../include/malloc.h"
 
-t_block *allocate_block(size_t size)
+/* Point the block after this one back at it */
+static void link_next(t_block *block)
 {
-    t_zone *zone;
-    t_block *block;
-
-    // Check if the size is within TINY or SMALL limits
-    if (size <= TINY_MAX)
-        zone = g_heap.tiny;
-    else if (size <= SMALL_MAX)
-        zone = g_heap.small;
-    else
-        return NULL; // For simplicity, we do not handle large allocations here
-
-    // Find a free block in the zone
-    block = find_free_block(zone, size);
-    if (!block)
+    NEXT_BLOCK(block)->prev_size = block->size / ALIGNMENT;
+}
+
+t_block *split_block(t_block *block, size_t size)
+{
+    if (block->size >= size + MIN_BLOCK)
     {
-        // If no free block found, create a new zone or split an existing one
-        zone = create_zone(TINY_ZONE_SIZE);
-        if (!zone)
-            return NULL; // Allocation failed
+        t_block *new_block = (t_block *)((char *)block + size);
+        new_block->size = block->size - (uint32_t)size;
+        new_block->is_free = true;
+        new_block->in_tcache = false;
+
+        block->size = (uint32_t)size;
+        block->is_free = false;
+        link_next(block);
+        link_next(new_block);
 
-        g_heap.tiny = zone; // Update the heap with the new zone
-        block = allocate_block(size); // Try to allocate again
+        return new_block; // Return the free tail
     }
 
-    return block;
+    return NULL; // Not enough space to split
+}
+
+t_block *prev_block(t_block *block)
+{
+    if (!block->prev_size)
+        return NULL;
+    return (t_block *)((char *)block - (size_t)block->prev_size * ALIGNMENT);
 }
 
-t_block *find_free_block(t_zone *zone, size_t size)
+void release_block(t_zone *zone, void *ptr)
 {
-    t_block *current = zone->blocks;
+    if (zone->size_class < TINY_CLASSES)
+    {
+        slab_free(zone, ptr);
+        return;
+    }
+    t_arena *arena = arena_of(zone);
+    t_block *block = BLOCK_OF(ptr);
+    t_block *prev = prev_block(block);
 
-    while (current)
+    // Coalesce with both neighbours: the back-link makes the left one O(1)
+    block->in_tcache = false;
+    block->is_free = true;
+    merge_blocks(arena, block);
+    if (prev && prev->is_free)
     {
-        if (current->is_free && current->size >= size)
-        {
-            return current;
-        }
-        current = current->next;
+        bin_remove(arena, prev);
+        prev->size += block->size;
+        link_next(prev);
+        block = prev;
     }
+    bin_insert(arena, block);
 
-    return NULL; // No suitable free block found
+    // Last block of the zone: keep it as a spare or unmap it
+    if (--zone->used == 0 && zone_emptied(arena, SMALL_ZONE_CLASS))
+    {
+        for (t_block *b = zone->blocks; b->size; b = NEXT_BLOCK(b))
+            bin_remove(arena, b);
+        unmap_zone(&arena->small, zone);
+    }
 }
 
-t_block *split_block(t_block *block, size_t size)
+/* Grow or shrink a SMALL block to size bytes (header included) without moving it, the owning arena must be locked */
+bool resize_block(t_zone *zone, t_block *block, size_t size)
 {
-    if (block->size >= size + sizeof(t_block) + ALIGNMENT)
-    {
-        t_block *new_block = (t_block *)((char *)block + sizeof(t_block) + size);
-        new_block->size = block->size - size - sizeof(t_block);
-        new_block->is_free = true;
-        new_block->next = block->next;
-        new_block->alloc_time = 0;
+    t_arena *arena = arena_of(zone);
+    t_block *next = NEXT_BLOCK(block);
+    t_block *tail;
+    bool grow;
 
-        block->size = size;
-        block->is_free = false;
-        block->next = new_block;
+    // Shrinking a block for a TINY size still leaves room for the free links
+    if (size < MIN_BLOCK)
+        size = MIN_BLOCK;
 
-        return block; // Return the original block, now resized
+    // Growing needs the following block to be free and large enough
+    grow = size > block->size;
+    if (grow)
+    {
+        if (!next->is_free || block->size + next->size < size)
+            return false;
+        merge_blocks(arena, block);
     }
 
-    return NULL; // Not enough space to split
+    // The absorbed memory now belongs to the user: move the zone's high-water mark
+    char *end = (char *)block + size;
+    if (end > zone->clean)
+        zone->clean = end;
+
+    // Give whatever is left over back to the zone. Only a shrunk block's
+    // tail held user data: a grown one's was free, and may lie past the
+    // high-water mark where calloc counts on zeros
+    if ((tail = split_block(block, size)))
+    {
+        if (g_heap.debug.scribble && !grow)
+            scribble_memory(BLOCK_DATA(tail), tail->size - sizeof(t_block), MALLOC_SCRIBBLE_FREE);
+        merge_blocks(arena, tail);
+        bin_insert(arena, tail);
+    }
+    return true;
 }
 
-void merge_blocks(t_block *block)
+void merge_blocks(t_arena *arena, t_block *block)
 {
-    if (block->next && block->next->is_free)
+    t_block *next = NEXT_BLOCK(block);
+
+    // The zone's fence is never free, it stops the merge at the end
+    if (next->is_free)
     {
-        block->size += block->next->size + sizeof(t_block);
-        block->next = block->next->next;
+        bin_remove(arena, next);
+        block->size += next->size;
+        link_next(block);
     }
 }
@@ -0,0 +1,52 @@
+#include "../include/malloc.h"
+#include <errno.h>
+
+/*
+    * Zero the dirty head of a LARGE mapping by dropping its whole pages:
+    * private anonymous pages come back zero-filled on the next touch, so a
+    * big buffer costs page faults instead of a full zeroing pass.
+*/
+static void zero_pages(char *ptr, size_t len)
+{
+    size_t page = (size_t)PAGE_SIZE;
+    char *first = (char *)(((uintptr_t)ptr + page - 1) & ~(uintptr_t)(page - 1));
+    char *last = (char *)(((uintptr_t)ptr + len) & ~(uintptr_t)(page - 1));
+
+    ft_memset(ptr, 0, first - ptr);
+    if (madvise(first, last - first, MADV_DONTNEED) != 0)
+        ft_memset(first, 0, last - first);
+    ft_memset(last, 0, ptr + len - last);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    size_t dirty;
+    void *ptr;
+
+    if (size && nmemb > SIZE_MAX / size)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    total = nmemb * size;
+
+    ptr = heap_alloc(total, &dirty);
+    if (g_heap.tracing)
+        trace_alloc(TRACE_CALLOC, ptr, total, 0);
+    if (!ptr)
+    {
+        if (total)
+            errno = ENOMEM;
+        return NULL;
+    }
+
+    // Fresh mmap pages and never used zone space are already zero
+    if (dirty > total)
+        dirty = total;
+    if (dirty >= CALLOC_MADVISE_MIN)
+        zero_pages(ptr, dirty);
+    else
+        ft_memset(ptr, 0, dirty);
+    return ptr;
+}
@@ -0,0 +1,245 @@
+#include "../include/malloc.h"
+#include <fcntl.h>
+#include <string.h>
+
+/*
+    * Hugepage-aware zone backend.
+    * TINY/SMALL zones are carved out of 2 MiB chunks aligned on a hugepage
+    * boundary and marked MADV_HUGEPAGE, so a busy heap is covered by a few
+    * huge TLB entries instead of thousands of 4 KiB ones. A zone takes a
+    * power-of-two run of units aligned on its size, which keeps slabs aligned
+    * for address masking. New zones go to the fullest chunk that has room,
+    * packing them into memory that is already backed. Freed units stay
+    * backed while the chunk is busy; once it is mostly empty they are dropped
+    * with MADV_DONTNEED, and an empty chunk beyond the spare one is given
+    * back (see vm.c).
+*/
+
+static size_t chunk_units(void)
+{
+    size_t units = CHUNK_SIZE / CHUNK_UNIT;
+
+    return units < CHUNK_MAX_UNITS ? units : CHUNK_MAX_UNITS;
+}
+
+/* Bits of units [start, start + count) in their 64-unit word; runs never straddle words */
+static uint64_t run_mask(size_t start, size_t count)
+{
+    uint64_t bits = count >= 64 ? ~0UL : (1UL << count) - 1;
+
+    return bits << (start % 64);
+}
+
+static bool chunk_backed(size_t size)
+{
+    return g_heap.hugepages && size <= CHUNK_SIZE / 2 && size >= CHUNK_UNIT;
+}
+
+static t_chunk *create_chunk(void)
+{
+    t_chunk *chunk;
+
+    // Commit a slot of the reserved range, or map the chunk on its own
+    if (!(chunk = vm_commit()))
+    {
+        chunk = map_aligned(CHUNK_SIZE, CHUNK_SIZE);
+        if (!chunk)
+            return NULL;
+        madvise(chunk, CHUNK_SIZE, MADV_HUGEPAGE);
+    }
+
+    chunk->used[0] = 1;     // The header's unit
+    chunk->used_units = 0;
+    chunk->prev = NULL;
+    chunk->next = g_heap.chunks;
+    if (chunk->next)
+        chunk->next->prev = chunk;
+    g_heap.chunks = chunk;
+    __atomic_fetch_add(&g_heap.stats.chunks, 1, __ATOMIC_RELAXED);
+    return chunk;
+}
+
+/* First free run of count units aligned on count, or 0 (unit 0 is the header) */
+static size_t find_run(t_chunk *chunk, size_t count)
+{
+    for (size_t start = count; start + count <= chunk_units(); start += count)
+    {
+        if (!(chunk->used[start / 64] & run_mask(start, count)))
+            return start;
+    }
+    return 0;
+}
+
+/* Drop the pages of every free unit that is still backed */
+static void purge_chunk(t_chunk *chunk)
+{
+    for (size_t unit = 1; unit < chunk_units(); unit++)
+    {
+        if (chunk->dirty[unit / 64] & run_mask(unit, 1))
+            madvise((char *)chunk + unit * CHUNK_UNIT, CHUNK_UNIT, MADV_DONTNEED);
+    }
+    for (size_t i = 0; i < CHUNK_MAX_UNITS / 64; i++)
+        chunk->dirty[i] = 0;
+    __atomic_fetch_add(&g_heap.stats.chunk_purges, 1, __ATOMIC_RELAXED);
+}
+
+void *zone_map(size_t size, bool *zeroed)
+{
+    size_t count = size / CHUNK_UNIT;
+    t_chunk *best = NULL;
+    size_t best_start = 0;
+    size_t start;
+
+    *zeroed = true;
+    if (!chunk_backed(size))
+        return map_aligned(size, size);
+
+    pthread_mutex_lock(&g_heap.chunk_mutex);
+
+    // Pack into the fullest chunk that still has room
+    for (t_chunk *chunk = g_heap.chunks; chunk; chunk = chunk->next)
+    {
+        if ((!best || chunk->used_units > best->used_units) && (start = find_run(chunk, count)))
+        {
+            best = chunk;
+            best_start = start;
+        }
+    }
+    if (!best && (best = create_chunk()))
+        best_start = find_run(best, count);
+    if (!best)
+    {
+        pthread_mutex_unlock(&g_heap.chunk_mutex);
+        return NULL;
+    }
+
+    uint64_t mask = run_mask(best_start, count);
+    *zeroed = !(best->dirty[best_start / 64] & mask);
+    best->used[best_start / 64] |= mask;
+    best->dirty[best_start / 64] &= ~mask;
+    best->used_units += count;
+
+    pthread_mutex_unlock(&g_heap.chunk_mutex);
+    return (char *)best + best_start * CHUNK_UNIT;
+}
+
+void zone_unmap(void *zone, size_t size)
+{
+    t_chunk *chunk = (t_chunk *)((uintptr_t)zone & ~(CHUNK_SIZE - 1));
+    size_t start = ((char *)zone - (char *)chunk) / CHUNK_UNIT;
+    size_t count = size / CHUNK_UNIT;
+    uint64_t mask = run_mask(start, count);
+
+    if (!chunk_backed(size))
+    {
+        os_unmap(zone, size);
+        return;
+    }
+
+    pthread_mutex_lock(&g_heap.chunk_mutex);
+    chunk->used[start / 64] &= ~mask;
+    chunk->dirty[start / 64] |= mask;
+    chunk->used_units -= count;
+
+    if (chunk->used_units == 0 && __atomic_load_n(&g_heap.stats.chunks, __ATOMIC_RELAXED) > SPARE_CHUNKS)
+    {
+        if (chunk->prev)
+            chunk->prev->next = chunk->next;
+        else
+            g_heap.chunks = chunk->next;
+        if (chunk->next)
+            chunk->next->prev = chunk->prev;
+        if (!vm_release(chunk))
+            os_unmap(chunk, CHUNK_SIZE);
+        __atomic_fetch_sub(&g_heap.stats.chunks, 1, __ATOMIC_RELAXED);
+    }
+    else if (chunk->used_units * CHUNK_PURGE_RATIO < chunk_units())
+        purge_chunk(chunk);
+
+    pthread_mutex_unlock(&g_heap.chunk_mutex);
+}
+
+static bool in_chunk(uintptr_t addr)
+{
+    for (t_chunk *chunk = g_heap.chunks; chunk; chunk = chunk->next)
+    {
+        if (addr >= (uintptr_t)chunk && addr < (uintptr_t)chunk + CHUNK_SIZE)
+            return true;
+    }
+    return false;
+}
+
+/* Account one line of /proc/self/smaps, in_heap tracks the current mapping */
+static size_t smaps_line(const char *line, bool *in_heap)
+{
+    static const char key[] = "AnonHugePages:";
+    uintptr_t start = 0;
+    size_t kb = 0;
+    const char *p = line;
+
+    // Mapping header: "start-end perms ...", starts with a hex digit
+    if ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f'))
+    {
+        for (; *p != '-' && *p; p++)
+            start = start * 16 + (uintptr_t)(*p <= '9' ? *p - '0' : *p - 'a' + 10);
+        *in_heap = vm_contains((void *)start) || in_chunk(start);
+        return 0;
+    }
+    if (!*in_heap || strncmp(line, key, sizeof(key) - 1) != 0)
+        return 0;
+    for (p = line + sizeof(key) - 1; *p == ' '; p++)
+        ;
+    for (; *p >= '0' && *p <= '9'; p++)
+        kb = kb * 10 + (size_t)(*p - '0');
+    return kb * 1024;
+}
+
+/*
+    * Sum the AnonHugePages lines of an smaps listing that fall in the
+    * chunks. Reads with a fixed buffer so it never allocates.
+*/
+size_t smaps_thp_bytes(int fd)
+{
+    char buf[4096];
+    size_t len = 0;
+    size_t total = 0;
+    bool in_heap = false;
+    ssize_t got;
+
+    pthread_mutex_lock(&g_heap.chunk_mutex);
+    while ((got = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+    {
+        char *line = buf;
+        char *end;
+
+        len += (size_t)got;
+        buf[len] = '\0';
+        while ((end = strchr(line, '\n')))
+        {
+            *end = '\0';
+            total += smaps_line(line, &in_heap);
+            line = end + 1;
+        }
+        // Keep the partial line, drop it if it fills the whole buffer
+        len = buf + len - line;
+        if (len == sizeof(buf) - 1)
+            len = 0;
+        memmove(buf, line, len);
+    }
+    pthread_mutex_unlock(&g_heap.chunk_mutex);
+    return total;
+}
+
+/* Bytes of the chunks the kernel actually backs with transparent huge pages */
+size_t chunk_thp_bytes(void)
+{
+    size_t total;
+    int fd;
+
+    fd = open("/proc/self/smaps", O_RDONLY);
+    if (fd < 0)
+        return 0;
+    total = smaps_thp_bytes(fd);
+    close(fd);
+    return total;
+}
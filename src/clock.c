@@ -0,0 +1,37 @@
+#include "../include/malloc.h"
+
+/*
+    * Timestamps.
+    * Nothing on the allocation path reads the time: only the history
+    * (MALLOC_STACK_LOGGING) and the LARGE cache's age limit need it. Both
+    * read the coarse monotonic clock, a vDSO load of the last tick that
+    * never touches the TSC, and the stamps are turned into wall time only
+    * when they are printed.
+*/
+
+static uint64_t coarse_ms(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Called once from heap_init(), pairs the monotonic clock with the wall clock */
+void heap_clock_init(void)
+{
+    g_heap.clock_base = coarse_ms(CLOCK_MONOTONIC_COARSE);
+    g_heap.wall_base = coarse_ms(CLOCK_REALTIME_COARSE);
+}
+
+/* Milliseconds on the coarse monotonic clock */
+uint64_t heap_clock(void)
+{
+    return coarse_ms(CLOCK_MONOTONIC_COARSE);
+}
+
+/* Wall time in seconds of a heap_clock() stamp */
+time_t heap_wall_time(uint64_t stamp)
+{
+    return (time_t)((g_heap.wall_base + stamp - g_heap.clock_base) / 1000);
+}
@@ -1,5 +1,4 @@
 #include "../include/malloc.h"
-#include <string.h>
 
 void init_debug_flags(void)
 {
@@ -17,6 +16,32 @@ void init_debug_flags(void)
     else
         g_heap.debug.check_level = 0;
 
+    env = getenv("MALLOC_SPARE_ZONES");
+    g_heap.spare_zones = env ? (size_t)atol(env) : DEFAULT_SPARE_ZONES;
+
+    env = getenv("MALLOC_HUGEPAGES");
+    g_heap.hugepages = !(env && env[0] == '0');
+
+    env = getenv("MALLOC_RESERVE");
+    g_heap.reserve_size = env ? (size_t)atol(env) : DEFAULT_RESERVE;
+
+    env = getenv("MALLOC_LARGE_CACHE");
+    g_heap.large_cache_max = env ? (size_t)atol(env) : DEFAULT_LARGE_CACHE;
+    env = getenv("MALLOC_LARGE_CACHE_AGE");
+    g_heap.large_cache_age = env ? (time_t)atol(env) : DEFAULT_LARGE_CACHE_AGE;
+
+    g_heap.profile_path = getenv("MALLOC_PROFILE");
+    env = getenv("MALLOC_PROFILE_RATE");
+    if (g_heap.profile_path)
+        g_heap.profile_rate = env ? (size_t)atol(env) : DEFAULT_PROFILE_RATE;
+    g_heap.trace_path = getenv("MALLOC_TRACE");
+
+    /* The thread cache skips scribbling and history, keep it off when they are wanted */
+    env = getenv("MALLOC_TCACHE");
+    g_heap.tcache_enabled = !(env && env[0] == '0')
+        && !g_heap.debug.scribble && !g_heap.debug.pre_scribble
+        && !g_heap.debug.stack_logging && g_heap.debug.check_level == 0;
+
     /* History buffer is statically allocated, no need to initialize */
 }
 
@@ -25,20 +50,28 @@ void add_to_history(void *ptr, size_t size, bool is_alloc)
     t_alloc_history *new_entry;
 
     // Ne pas allouer d'historique si pas nécessaire pour économiser des pages
-    if (!g_heap.debug.stack_logging || g_heap.history_count >= MAX_ALLOC_HISTORY)
+    if (!g_heap.debug.stack_logging)
         return;
 
+    pthread_mutex_lock(&g_heap.mutex);
+    if (g_heap.history_count >= MAX_ALLOC_HISTORY)
+    {
+        pthread_mutex_unlock(&g_heap.mutex);
+        return;
+    }
+
     // Utiliser le buffer statique au lieu de mmap pour économiser des pages
     size_t index = g_heap.history_count % MAX_ALLOC_HISTORY;
     new_entry = &g_heap.history_buffer[index];
 
     new_entry->ptr = ptr;
     new_entry->size = size;
-    new_entry->timestamp = time(NULL);
+    new_entry->timestamp = heap_clock();
     new_entry->is_freed = !is_alloc;
     new_entry->next = NULL;  // Plus besoin de linked list
 
     g_heap.history_count++;
+    pthread_mutex_unlock(&g_heap.mutex);
 }
 
 void scribble_memory(void *ptr, size_t size, unsigned char pattern)
@@ -46,7 +79,7 @@ void scribble_memory(void *ptr, size_t size, unsigned char pattern)
     if (!ptr || size == 0)
         return;
     
-    memset(ptr, pattern, size);
+    ft_memset(ptr, pattern, size);
 }
 
 void check_guards(void *ptr)
@@ -60,52 +93,42 @@ void check_guards(void *ptr)
     (void)ptr; /* Suppress unused parameter warning */
 }
 
-void defragment_zones(void)
+void defragment_zones(t_arena *arena)
 {
     t_zone *zone;
     t_block *current, *next;
 
-    /* Defragment TINY zones */
-    for (zone = g_heap.tiny; zone; zone = zone->next)
-    {
-        current = zone->blocks;
-        while (current && current->next)
-        {
-            if (current->is_free && current->next->is_free)
-            {
-                /* Merge adjacent free blocks */
-                current->size += current->next->size + sizeof(t_block);
-                next = current->next->next;
-                current->next = next;
-                /* Continue checking from current block */
-                continue;
-            }
-            current = current->next;
-        }
-    }
+    /* TINY zones are slabs of equal slots, there is nothing to merge */
 
     /* Defragment SMALL zones */
-    for (zone = g_heap.small; zone; zone = zone->next)
+    for (zone = arena->small; zone; zone = zone->next)
     {
         current = zone->blocks;
-        while (current && current->next)
+        while (current->size)
         {
-            if (current->is_free && current->next->is_free)
+            next = NEXT_BLOCK(current);
+            if (current->is_free && next->is_free)
             {
-                /* Merge adjacent free blocks */
-                current->size += current->next->size + sizeof(t_block);
-                next = current->next->next;
-                current->next = next;
+                /* Merge adjacent free blocks, the result changes bin */
+                bin_remove(arena, current);
+                bin_remove(arena, next);
+                current->size += next->size;
+                NEXT_BLOCK(current)->prev_size = current->size / ALIGNMENT;
+                bin_insert(arena, current);
                 continue;
             }
-            current = current->next;
+            current = next;
         }
     }
 }
 
 void malloc_defragment(void)
 {
-    pthread_mutex_lock(&g_heap.mutex);
-    defragment_zones();
-    pthread_mutex_unlock(&g_heap.mutex);
+    for (size_t i = 0; i < g_heap.arena_count; i++)
+    {
+        pthread_mutex_lock(&g_heap.arenas[i].mutex);
+        drain_remote_frees(&g_heap.arenas[i]);
+        defragment_zones(&g_heap.arenas[i]);
+        pthread_mutex_unlock(&g_heap.arenas[i].mutex);
+    }
 }
\ No newline at end of file
@@ -1,51 +1,194 @@
 #include "../include/malloc.h"
 
-void free(void *ptr)
+/* Give a TINY/SMALL block back, through the thread cache when possible */
+static void free_block(void *ptr, t_zone *zone)
 {
-    t_block *block;
+    t_arena *arena;
+    size_t size;
 
-    if (!ptr)
+    // Take the block from the user first: a slot that is not live, or a
+    // block already parked in a thread cache, is a double free
+    if (zone->size_class < TINY_CLASSES)
+    {
+        if (!slot_release(zone, ptr))
+            return;
+        size = tiny_class_size(zone->size_class);
+    }
+    else
+    {
+        t_block *block = BLOCK_OF(ptr);
+
+        if (block->in_tcache)
+            return;
+        block->in_tcache = true;
+        size = block->size - sizeof(t_block);
+    }
+    stats_free(zone->size_class < TINY_CLASSES ? PAGE_TINY : PAGE_SMALL, size);
+    if (__atomic_load_n(&zone->sampled, __ATOMIC_RELAXED) && profile_free(ptr))
+        __atomic_fetch_sub(&zone->sampled, 1, __ATOMIC_RELAXED);
+
+    // TINY/SMALL blocks go to the thread cache first, no lock needed. SMALL
+    // blocks no bigger than a TINY class only come from aligned or shrunk
+    // allocations, they stay out of the TINY bins
+    if ((zone->size_class < TINY_CLASSES || size > TINY_MAX) && tcache_put(ptr, size))
         return;
 
-    pthread_mutex_lock(&g_heap.mutex);
+    /* Scribble freed memory if debug flag is set */
+    if (g_heap.debug.scribble)
+        scribble_memory(ptr, size, MALLOC_SCRIBBLE_FREE);
+    
+    /* Add to history */
+    add_to_history(ptr, size, false);
 
-    block = (t_block *)((char *)ptr - sizeof(t_block));
+    // Route the block back to the arena that allocated it, never wait for it
+    arena = arena_of(zone);
+    if (pthread_mutex_trylock(&arena->mutex) != 0)
+    {
+        remote_free(arena, ptr);
+        return;
+    }
+    drain_remote_frees(arena);
+    release_block(zone, ptr);
 
-    // If it's a LARGE allocation (blocks stored in g_heap.large), unmap it
-    t_block *prev = NULL;
-    t_block *cur = g_heap.large;
-    while (cur)
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+/* free() without the trace, for realloc */
+void heap_free(void *ptr)
+{
+    t_large *large;
+    t_arena *arena;
+    uintptr_t owner;
+
+    if (!ptr)
+        return;
+
+    // Ignore pointers that do not belong to one of our zones or mappings
+    owner = pagemap_get(ptr);
+    if (!owner)
+        return;
+
+    // If it's a LARGE allocation, unregister it and cache or unmap it
+    if (PAGEMAP_KIND(owner) == PAGE_LARGE)
     {
-        if (cur == block)
+        large = (t_large *)((char *)ptr - sizeof(t_large));
+        if (PAGEMAP_OWNER(owner) != large)
+            return;
+        arena = &g_heap.arenas[large->arena];
+        stats_free(PAGE_LARGE, large_usable(large, ptr));
+        if (large->sampled)
         {
-            // unlink from large list
-            if (prev)
-                prev->next = cur->next;
-            else
-                g_heap.large = cur->next;
-            size_t total = sizeof(t_block) + cur->size;
-            munmap((void *)cur, total);
-            pthread_mutex_unlock(&g_heap.mutex);
+            profile_free(ptr);
+            large->sampled = false;
+        }
+        pagemap_clear(ptr, ALIGNMENT);
+        // The cache belongs to the arena: when it is busy, unmap right away
+        if (pthread_mutex_trylock(&arena->mutex) != 0)
+        {
+            large->next = NULL;
+            large_cache_unmap(large);
             return;
         }
-        prev = cur;
-        cur = cur->next;
+        large = large_cache_put(arena, large);
+        pthread_mutex_unlock(&arena->mutex);
+        large_cache_unmap(large);
+        return;
     }
 
-    // Otherwise it's a TINY/SMALL block: mark free and try to merge
-    
-    /* Scribble freed memory if debug flag is set */
-    if (g_heap.debug.scribble)
+    free_block(ptr, PAGEMAP_OWNER(owner));
+}
+
+void free(void *ptr)
+{
+    if (ptr && g_heap.tracing)
+        trace_free(ptr);
+    heap_free(ptr);
+}
+
+/*
+    * With MALLOC_CHECK_ set, make sure the caller's size is the one the block
+    * was requested with: it maps to the slot's TINY class, to a SMALL block
+    * that size (a split leaves less than MIN_BLOCK of slack), or to the size
+    * recorded for a LARGE mapping. Level 1 reports a mismatch, level 2 and
+    * above abort.
+*/
+static bool free_size_matches(void *ptr, size_t alignment, size_t size)
+{
+    uintptr_t owner = pagemap_get(ptr);
+    t_zone *zone = PAGEMAP_OWNER(owner);
+    size_t block;
+
+    if (!owner || size == 0 || size > MAX_ALLOC_SIZE)
+        return false;
+    if (PAGEMAP_KIND(owner) == PAGE_LARGE)
     {
-        void *user_ptr = (void *)((char *)block + sizeof(t_block));
-        scribble_memory(user_ptr, block->size, MALLOC_SCRIBBLE_FREE);
+        t_large *large = (t_large *)((char *)ptr - sizeof(t_large));
+
+        return PAGEMAP_OWNER(owner) == large && ALIGN(size) == ALIGN(large->size);
     }
-    
-    /* Add to history */
-    add_to_history(ptr, block->size, false);
-    
-    block->is_free = true;
-    merge_blocks(block);
+    if (zone->size_class < TINY_CLASSES)
+        return size <= TINY_MAX && zone->size_class == (alignment > ALIGNMENT
+            ? tiny_aligned_class(ALIGN(size), alignment) : tiny_class(ALIGN(size)));
+    block = BLOCK_SIZE(size) < MIN_BLOCK ? MIN_BLOCK : BLOCK_SIZE(size);
+    return size <= SMALL_MAX && BLOCK_OF(ptr)->size >= BLOCK_SIZE(size)
+        && BLOCK_OF(ptr)->size < block + MIN_BLOCK;
+}
+
+static void check_free_size(void *ptr, size_t alignment, size_t size)
+{
+    if (g_heap.debug.check_level == 0 || free_size_matches(ptr, alignment, size))
+        return;
+
+    write(2, "malloc: free_sized(): size does not match the block\n", 52);
+    if (g_heap.debug.check_level >= 2)
+        abort();
+}
+
+/*
+    * C23 sized free. No LARGE block holds SMALL_MAX bytes or less (realloc
+    * moves a LARGE block shrunk that far), so the size tells the class and
+    * the LARGE and foreign pointer checks of free() are skipped: a SMALL
+    * zone is found by masking the pointer, its block header sits right
+    * before it. A TINY size may also be a SMALL block shrunk in place, only
+    * those look up the page map.
+*/
+static void free_known_size(void *ptr, size_t size)
+{
+    t_zone *zone;
 
-    pthread_mutex_unlock(&g_heap.mutex);
+    if (size > TINY_MAX)
+        zone = (t_zone *)((uintptr_t)ptr & ~(uintptr_t)(SMALL_ZONE_SIZE - 1));
+    else if (!(zone = PAGEMAP_OWNER(pagemap_get(ptr))))
+        return;
+    if (g_heap.tracing)
+        trace_free(ptr);
+    free_block(ptr, zone);
+}
+
+void free_sized(void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+    // Checked sizes, and sizes only a LARGE block can hold, take the full path
+    if (g_heap.debug.check_level == 0 && size && size <= SMALL_MAX)
+    {
+        free_known_size(ptr, size);
+        return;
+    }
+    check_free_size(ptr, ALIGNMENT, size);
+    free(ptr);
+}
+
+/* Alignments above a page are served by LARGE mappings whatever the size */
+void free_aligned_sized(void *ptr, size_t alignment, size_t size)
+{
+    if (!ptr)
+        return;
+    if (g_heap.debug.check_level == 0 && size && size <= SMALL_MAX && alignment <= (size_t)PAGE_SIZE)
+    {
+        free_known_size(ptr, size);
+        return;
+    }
+    check_free_size(ptr, alignment, size);
+    free(ptr);
 }
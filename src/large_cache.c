@@ -0,0 +1,167 @@
+#include "../include/malloc.h"
+
+/*
+    * Retained LARGE mappings.
+    * A freed LARGE mapping is parked in its arena instead of being unmapped,
+    * binned by page count like the SMALL free lists, and handed back to the
+    * next LARGE request of the same size range. This saves the mmap/munmap
+    * pair and the page faults of touching fresh pages again.
+    * The cache is bounded per arena by MALLOC_LARGE_CACHE bytes, oldest
+    * mappings first. Mappings idle for more than MALLOC_LARGE_CACHE_AGE
+    * seconds are dropped when another one is released, and by
+    * large_cache_trim() so an arena that stops freeing LARGE blocks still
+    * gives them back.
+*/
+
+#define CACHED(large) ((t_cached_large *)((char *)(large) + sizeof(t_large)))
+
+static size_t large_bin(size_t pages)
+{
+    size_t bin = small_bin(pages * ALIGNMENT);
+
+    return bin < LARGE_CACHE_BINS ? bin : LARGE_CACHE_BINS - 1;
+}
+
+static size_t mapping_bytes(t_large *large)
+{
+    return (size_t)large->pages * PAGE_SIZE;
+}
+
+static void cache_remove(t_arena *arena, t_large *large)
+{
+    t_cached_large *links = CACHED(large);
+
+    if (links->bin_prev)
+        CACHED(links->bin_prev)->bin_next = links->bin_next;
+    else
+        arena->large_bins[large_bin(large->pages)] = links->bin_next;
+    if (links->bin_next)
+        CACHED(links->bin_next)->bin_prev = links->bin_prev;
+
+    if (links->newer)
+        CACHED(links->newer)->older = links->older;
+    else
+        arena->large_newest = links->older;
+    if (links->older)
+        CACHED(links->older)->newer = links->newer;
+    else
+        arena->large_oldest = links->newer;
+
+    arena->large_cached -= mapping_bytes(large);
+}
+
+/* Unlink and return a cached mapping of at least pages pages, or NULL */
+t_large *large_cache_take(t_arena *arena, size_t pages)
+{
+    size_t bin = large_bin(pages);
+    t_large *large;
+
+    // A fit may sit just across the bin boundary: look at the next bin too,
+    // but never leave more than a quarter of the mapping unused
+    for (size_t last = bin + 1 < LARGE_CACHE_BINS ? bin + 1 : bin; bin <= last; bin++)
+    {
+        for (large = arena->large_bins[bin]; large; large = CACHED(large)->bin_next)
+        {
+            if (large->pages >= pages && large->pages - pages <= pages / 4)
+            {
+                cache_remove(arena, large);
+                __atomic_fetch_add(&g_heap.stats.large_hits, 1, __ATOMIC_RELAXED);
+                return large;
+            }
+        }
+    }
+    __atomic_fetch_add(&g_heap.stats.large_misses, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Unlink the expired mappings, then the oldest until room bytes fit, chained through their next field */
+static t_large *cache_evict(t_arena *arena, uint64_t now, size_t room)
+{
+    t_large *evicted = NULL;
+    t_large *oldest;
+
+    while ((oldest = arena->large_oldest)
+           && (now - CACHED(oldest)->released > (uint64_t)g_heap.large_cache_age * 1000
+               || arena->large_cached + room > g_heap.large_cache_max))
+    {
+        cache_remove(arena, oldest);
+        oldest->next = evicted;
+        evicted = oldest;
+    }
+    return evicted;
+}
+
+/*
+    * Park a freed LARGE mapping. Returns the mappings that must be unmapped,
+    * chained through their next field: the mapping itself when it does not fit
+    * the budget, and any mapping evicted for age or room.
+*/
+t_large *large_cache_put(t_arena *arena, t_large *large)
+{
+    t_large *evicted;
+    uint32_t pages = large->pages;
+    uint64_t now;
+
+    // Aligned blocks keep their header further in the first page: cache
+    // the mapping from its start
+    large = (t_large *)((uintptr_t)large & ~(uintptr_t)(PAGE_SIZE - 1));
+    large->pages = pages;
+
+    size_t bytes = mapping_bytes(large);
+
+    if (bytes > g_heap.large_cache_max)
+    {
+        large->next = NULL;
+        return large;
+    }
+
+    // Drop mappings that sat unused too long, then make room
+    now = heap_clock();
+    evicted = cache_evict(arena, now, bytes);
+
+    size_t bin = large_bin(large->pages);
+    t_cached_large *links = CACHED(large);
+
+    links->released = now;
+    links->bin_prev = NULL;
+    links->bin_next = arena->large_bins[bin];
+    if (links->bin_next)
+        CACHED(links->bin_next)->bin_prev = large;
+    arena->large_bins[bin] = large;
+
+    links->newer = NULL;
+    links->older = arena->large_newest;
+    if (links->older)
+        CACHED(links->older)->newer = large;
+    else
+        arena->large_oldest = large;
+    arena->large_newest = large;
+
+    arena->large_cached += bytes;
+    return evicted;
+}
+
+/*
+    * Unmap the expired mappings of an arena. Called where the arena already
+    * makes a system call under its lock: a LARGE cache miss and a zone
+    * release.
+*/
+void large_cache_trim(t_arena *arena)
+{
+    if (arena->large_oldest)
+        large_cache_unmap(cache_evict(arena, heap_clock(), 0));
+}
+
+void large_cache_unmap(t_large *chain)
+{
+    t_large *next;
+
+    while (chain)
+    {
+        next = chain->next;
+        __atomic_fetch_add(&g_heap.stats.large_munmaps, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&g_heap.stats.large_mapped, mapping_bytes(chain), __ATOMIC_RELAXED);
+        os_unmap((void *)((uintptr_t)chain & ~(uintptr_t)(PAGE_SIZE - 1)), mapping_bytes(chain));
+        chain = next;
+    }
+}
@@ -1,52 +1,173 @@
 #include "../include/malloc.h"
+#include <errno.h>
 
 t_heap g_heap = {
-    .tiny = NULL,
-    .small = NULL, 
-    .large = NULL,
+    .arenas = {{0}},
+    .arena_count = 0,
     .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .chunk_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .chunks = NULL,
+    .hugepages = true,
+    .reserve = NULL,
+    .reserve_size = 0,
+    .reserve_used = {0},
     .debug = {false, false, false, false, 0},
+    .tcache_enabled = false,
+    .spare_zones = DEFAULT_SPARE_ZONES,
+    .large_cache_max = DEFAULT_LARGE_CACHE,
+    .large_cache_age = DEFAULT_LARGE_CACHE_AGE,
+    .stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
     .history_buffer = {{0}},  // Buffer statique initialisé
     .history_count = 0
 };
 
-void *malloc(size_t size)
+/* Account a new block and offer it to the profiler: SMALL splits may leave a little more than asked for */
+static void count_alloc(int kind, void *ptr, size_t size)
+{
+    if (kind == PAGE_SMALL)
+        size = BLOCK_OF(ptr)->size - sizeof(t_block);
+    else if (kind == PAGE_LARGE)
+        size = large_usable((t_large *)((char *)ptr - sizeof(t_large)), ptr);
+    stats_alloc(kind, size);
+    if (g_heap.profile_rate)
+        profile_alloc(ptr, size, kind);
+}
+
+/* malloc() with the number of leading bytes that may hold old data */
+void *heap_alloc(size_t size, size_t *dirty)
 {
     void *ptr;
-    static bool debug_initialized = false;
+    t_arena *arena;
+    size_t usable;
+    int kind;
 
-    if (size == 0)
+    if (size == 0 || size > MAX_ALLOC_SIZE)
         return NULL;
 
-    size = ALIGN(size);
+    /* TINY requests are served from fixed size classes, SMALL ones from a
+       block rounded up with its header: usable is what the user gets */
+    if (size <= TINY_MAX)
+    {
+        usable = tiny_class_size(tiny_class(ALIGN(size)));
+        kind = PAGE_TINY;
+    }
+    else if (size <= SMALL_MAX)
+    {
+        usable = BLOCK_SIZE(size) - sizeof(t_block);
+        kind = PAGE_SMALL;
+    }
+    else
+    {
+        usable = ALIGN(size);
+        kind = PAGE_LARGE;
+    }
+
+    /* Initialize debug flags and arenas once */
+    heap_init();
 
-    pthread_mutex_lock(&g_heap.mutex);
-    
-    /* Initialize debug flags once */
-    if (!debug_initialized)
+    /* Lock-free fast path: reuse a block this thread freed recently */
+    if (size <= SMALL_MAX && (ptr = tcache_get(usable)))
     {
-        init_debug_flags();
-        debug_initialized = true;
+        *dirty = usable;
+        count_alloc(kind, ptr, usable);
+        return ptr;
     }
-    
+
+    arena = arena_lock();
+
     if (size <= TINY_MAX)
-        ptr = allocate_from_zone(&g_heap.tiny, size, TINY_ZONE_SIZE);
+        ptr = allocate_slab(arena, tiny_class(usable), dirty);
     else if (size <= SMALL_MAX)
-        ptr = allocate_from_zone(&g_heap.small, size, SMALL_ZONE_SIZE);
+        ptr = allocate_from_zone(arena, &arena->small, usable, SMALL_ZONE_SIZE, dirty);
     else
-        ptr = allocate_large(size);
+        ptr = allocate_large(arena, usable, ALIGNMENT, dirty);
+    size = usable;
+
+    pthread_mutex_unlock(&arena->mutex);
 
     if (ptr)
     {
+        count_alloc(kind, ptr, size);
+
         /* Pre-scribble allocated memory */
         if (g_heap.debug.pre_scribble)
+        {
             scribble_memory(ptr, size, MALLOC_SCRIBBLE_ALLOC);
+            *dirty = size;
+        }
         
         /* Add to allocation history */
         add_to_history(ptr, size, true);
     }
 
-    pthread_mutex_unlock(&g_heap.mutex);
-    
     return ptr;
-}
\ No newline at end of file
+}
+
+/*
+    * Aligned variant: alignment is a power of two. Small alignments use a TINY
+    * class whose slots are naturally aligned, then aligned placement inside a
+    * SMALL zone; anything else gets a LARGE mapping laid out for it.
+*/
+void *heap_alloc_aligned(size_t size, size_t alignment, size_t *dirty)
+{
+    void *ptr;
+    t_arena *arena;
+    size_t size_class;
+    int kind;
+
+    if (alignment <= ALIGNMENT)
+        return heap_alloc(size, dirty);
+    if (size == 0 || size > MAX_ALLOC_SIZE || alignment > MAX_ALLOC_SIZE)
+        return NULL;
+
+    heap_init();
+
+    /* The thread cache mixes blocks of every alignment, skip it */
+    arena = arena_lock();
+
+    size_class = size <= TINY_MAX ? tiny_aligned_class(ALIGN(size), alignment) : TINY_CLASSES;
+    if (size_class < TINY_CLASSES)
+    {
+        size = tiny_class_size(size_class);
+        ptr = allocate_slab(arena, size_class, dirty);
+        kind = PAGE_TINY;
+    }
+    else if (size <= SMALL_MAX && alignment <= (size_t)PAGE_SIZE)
+    {
+        ptr = allocate_aligned_from_zone(arena, size, alignment, dirty);
+        kind = PAGE_SMALL;
+    }
+    else
+    {
+        ptr = allocate_large(arena, ALIGN(size), alignment, dirty);
+        kind = PAGE_LARGE;
+    }
+
+    pthread_mutex_unlock(&arena->mutex);
+
+    if (ptr)
+    {
+        count_alloc(kind, ptr, size);
+        if (g_heap.debug.pre_scribble)
+        {
+            scribble_memory(ptr, size, MALLOC_SCRIBBLE_ALLOC);
+            *dirty = size;
+        }
+        add_to_history(ptr, size, true);
+    }
+
+    return ptr;
+}
+
+void *malloc(size_t size)
+{
+    size_t dirty;
+    void *ptr;
+
+    ptr = heap_alloc(size, &dirty);
+    if (g_heap.tracing)
+        trace_alloc(TRACE_MALLOC, ptr, size, 0);
+    if (!ptr && size)
+        errno = ENOMEM;
+    return ptr;
+}
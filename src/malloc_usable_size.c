@@ -0,0 +1,32 @@
+#include "../include/malloc.h"
+
+/*
+    * Bytes the caller may use: the TINY class, the SMALL block minus its
+    * header, which includes the slack left by rounding and splitting, or the
+    * rest of the mapping for LARGE blocks.
+*/
+size_t malloc_usable_size(void *ptr)
+{
+    uintptr_t owner;
+    t_zone *zone;
+
+    if (!ptr)
+        return 0;
+
+    owner = pagemap_get(ptr);
+    if (!owner)
+        return 0;
+
+    if (PAGEMAP_KIND(owner) == PAGE_LARGE)
+    {
+        t_large *large = (t_large *)((char *)ptr - sizeof(t_large));
+
+        if (PAGEMAP_OWNER(owner) != large)
+            return 0;
+        return large_usable(large, ptr);
+    }
+    zone = PAGEMAP_OWNER(owner);
+    if (zone->size_class < TINY_CLASSES)
+        return tiny_class_size(zone->size_class);
+    return BLOCK_OF(ptr)->size - sizeof(t_block);
+}
@@ -0,0 +1,69 @@
+#include "../include/malloc.h"
+#include <errno.h>
+
+static bool is_power_of_two(size_t n)
+{
+    return n && !(n & (n - 1));
+}
+
+static void *aligned(size_t alignment, size_t size)
+{
+    size_t dirty;
+    void *ptr;
+
+    ptr = heap_alloc_aligned(size, alignment, &dirty);
+    if (g_heap.tracing)
+        trace_alloc(TRACE_ALIGNED, ptr, size, alignment);
+    if (!ptr && size)
+        errno = ENOMEM;
+    return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    size_t dirty;
+
+    if (!is_power_of_two(alignment) || alignment % sizeof(void *))
+        return EINVAL;
+    *memptr = heap_alloc_aligned(size, alignment, &dirty);
+    if (g_heap.tracing)
+        trace_alloc(TRACE_ALIGNED, *memptr, size, alignment);
+    return *memptr || !size ? 0 : ENOMEM;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (!is_power_of_two(alignment))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return aligned(alignment, size);
+}
+
+/* Like glibc, a non power of two alignment is rounded up */
+void *memalign(size_t alignment, size_t size)
+{
+    size_t rounded = ALIGNMENT;
+
+    if (alignment > MAX_ALLOC_SIZE)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    while (rounded < alignment)
+        rounded <<= 1;
+    return aligned(rounded, size);
+}
+
+void *valloc(size_t size)
+{
+    return aligned(PAGE_SIZE, size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = PAGE_SIZE;
+
+    return aligned(page, size ? (size + page - 1) & ~(page - 1) : page);
+}
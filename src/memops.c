@@ -0,0 +1,259 @@
+#include "../include/malloc.h"
+#ifdef __x86_64__
+# include <immintrin.h>
+#endif
+
+/*
+    * Copy and fill kernels.
+    * ft_memcpy() and ft_memset() pick the widest vector unit of the CPU on
+    * their first call: AVX2 moves 32 bytes at a time, SSE2 (always there on
+    * x86_64) 16. Other machines keep word-sized loops. Lengths below a vector
+    * are done with two overlapping moves, the last vector is stored from the
+    * end of the buffer instead of looping over the tail.
+    * From MEMOPS_STREAM_MIN bytes on, stores are non-temporal: a buffer that
+    * large would only push the working set out of the cache.
+*/
+
+typedef void *(*t_copy_fn)(void *dest, const void *src, size_t n);
+typedef void *(*t_fill_fn)(void *dest, int c, size_t n);
+
+#define BYTES_OF(c) (0x0101010101010101ULL * (unsigned char)(c))
+
+/* Up to 16 bytes */
+static void copy_small(char *d, const char *s, size_t n)
+{
+    if (n >= 8)
+    {
+        uint64_t head;
+        uint64_t tail;
+
+        __builtin_memcpy(&head, s, 8);
+        __builtin_memcpy(&tail, s + n - 8, 8);
+        __builtin_memcpy(d, &head, 8);
+        __builtin_memcpy(d + n - 8, &tail, 8);
+    }
+    else if (n >= 4)
+    {
+        uint32_t head;
+        uint32_t tail;
+
+        __builtin_memcpy(&head, s, 4);
+        __builtin_memcpy(&tail, s + n - 4, 4);
+        __builtin_memcpy(d, &head, 4);
+        __builtin_memcpy(d + n - 4, &tail, 4);
+    }
+    else if (n)
+    {
+        d[0] = s[0];
+        d[n / 2] = s[n / 2];
+        d[n - 1] = s[n - 1];
+    }
+}
+
+/* Up to 16 bytes */
+static void fill_small(char *d, int c, size_t n)
+{
+    uint64_t bytes = BYTES_OF(c);
+
+    if (n >= 8)
+    {
+        __builtin_memcpy(d, &bytes, 8);
+        __builtin_memcpy(d + n - 8, &bytes, 8);
+    }
+    else if (n >= 4)
+    {
+        __builtin_memcpy(d, &bytes, 4);
+        __builtin_memcpy(d + n - 4, &bytes, 4);
+    }
+    else if (n)
+    {
+        d[0] = (char)c;
+        d[n / 2] = (char)c;
+        d[n - 1] = (char)c;
+    }
+}
+
+#ifdef __x86_64__
+
+static void *copy_sse2(void *dest, const void *src, size_t n)
+{
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+
+    if (n <= 16)
+    {
+        copy_small(d, s, n);
+        return dest;
+    }
+
+    char *end = d + n - 16;
+    __m128i tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+
+    if (n >= MEMOPS_STREAM_MIN)
+    {
+        // Streaming stores must be aligned: copy the head unaligned first
+        size_t skew = 16 - ((uintptr_t)d & 15);
+
+        _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+        for (d += skew, s += skew; d + 16 <= end; d += 16, s += 16)
+            _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+        _mm_sfence();
+    }
+    for (; d < end; d += 16, s += 16)
+        _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    _mm_storeu_si128((__m128i *)end, tail);
+    return dest;
+}
+
+static void *fill_sse2(void *dest, int c, size_t n)
+{
+    char *d = (char *)dest;
+
+    if (n <= 16)
+    {
+        fill_small(d, c, n);
+        return dest;
+    }
+
+    char *end = d + n - 16;
+    __m128i bytes = _mm_set1_epi8((char)c);
+
+    if (n >= MEMOPS_STREAM_MIN)
+    {
+        _mm_storeu_si128((__m128i *)d, bytes);
+        for (d += 16 - ((uintptr_t)d & 15); d + 16 <= end; d += 16)
+            _mm_stream_si128((__m128i *)d, bytes);
+        _mm_sfence();
+    }
+    for (; d < end; d += 16)
+        _mm_storeu_si128((__m128i *)d, bytes);
+    _mm_storeu_si128((__m128i *)end, bytes);
+    return dest;
+}
+
+__attribute__((target("avx2")))
+static void *copy_avx2(void *dest, const void *src, size_t n)
+{
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+
+    if (n <= 32)
+        return copy_sse2(dest, src, n);
+
+    char *end = d + n - 32;
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+
+    if (n >= MEMOPS_STREAM_MIN)
+    {
+        size_t skew = 32 - ((uintptr_t)d & 31);
+
+        _mm256_storeu_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+        for (d += skew, s += skew; d + 32 <= end; d += 32, s += 32)
+            _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+        _mm_sfence();
+    }
+    for (; d < end; d += 32, s += 32)
+        _mm256_storeu_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    _mm256_storeu_si256((__m256i *)end, tail);
+    return dest;
+}
+
+__attribute__((target("avx2")))
+static void *fill_avx2(void *dest, int c, size_t n)
+{
+    char *d = (char *)dest;
+
+    if (n <= 32)
+        return fill_sse2(dest, c, n);
+
+    char *end = d + n - 32;
+    __m256i bytes = _mm256_set1_epi8((char)c);
+
+    if (n >= MEMOPS_STREAM_MIN)
+    {
+        _mm256_storeu_si256((__m256i *)d, bytes);
+        for (d += 32 - ((uintptr_t)d & 31); d + 32 <= end; d += 32)
+            _mm256_stream_si256((__m256i *)d, bytes);
+        _mm_sfence();
+    }
+    for (; d < end; d += 32)
+        _mm256_storeu_si256((__m256i *)d, bytes);
+    _mm256_storeu_si256((__m256i *)end, bytes);
+    return dest;
+}
+
+static t_copy_fn pick_copy(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? copy_avx2 : copy_sse2;
+}
+
+static t_fill_fn pick_fill(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? fill_avx2 : fill_sse2;
+}
+
+#else
+
+static void *copy_words(void *dest, const void *src, size_t n)
+{
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+
+    for (; n > 16; n -= 8, d += 8, s += 8)
+        __builtin_memcpy(d, s, 8);
+    copy_small(d, s, n);
+    return dest;
+}
+
+static void *fill_words(void *dest, int c, size_t n)
+{
+    char *d = (char *)dest;
+    uint64_t bytes = BYTES_OF(c);
+
+    for (; n > 16; n -= 8, d += 8)
+        __builtin_memcpy(d, &bytes, 8);
+    fill_small(d, c, n);
+    return dest;
+}
+
+static t_copy_fn pick_copy(void)
+{
+    return copy_words;
+}
+
+static t_fill_fn pick_fill(void)
+{
+    return fill_words;
+}
+
+#endif
+
+static t_copy_fn g_copy;
+static t_fill_fn g_fill;
+
+void *ft_memcpy(void *dest, const void *src, size_t n)
+{
+    t_copy_fn copy = __atomic_load_n(&g_copy, __ATOMIC_RELAXED);
+
+    // Racing threads pick the same kernel, the second store is harmless
+    if (!copy)
+    {
+        copy = pick_copy();
+        __atomic_store_n(&g_copy, copy, __ATOMIC_RELAXED);
+    }
+    return copy(dest, src, n);
+}
+
+void *ft_memset(void *dest, int c, size_t n)
+{
+    t_fill_fn fill = __atomic_load_n(&g_fill, __ATOMIC_RELAXED);
+
+    if (!fill)
+    {
+        fill = pick_fill();
+        __atomic_store_n(&g_fill, fill, __ATOMIC_RELAXED);
+    }
+    return fill(dest, c, n);
+}
@@ -0,0 +1,138 @@
+#include "../include/malloc.h"
+
+/*
+    * Page map: a 3-level radix tree indexed by page number (48-bit address
+    * space, 4 KiB granularity) that records which zone or LARGE mapping owns
+    * each page. Entries are the owner's address tagged with its kind in the
+    * low bits. Zones register every page they span; LARGE mappings only
+    * register their header page, which is where their user pointer lives.
+    * Nodes are mmap'd on first use and never released; updates to the
+    * entries are done by the owning arena, lookups are lock-free.
+*/
+
+#define PM_SHIFT        12
+#define PM_LEVEL_BITS   12
+#define PM_FANOUT       (1UL << PM_LEVEL_BITS)
+#define PM_NODE_SIZE    (PM_FANOUT * sizeof(void *))
+#define PM_PAGES        (1UL << (3 * PM_LEVEL_BITS))
+
+static uintptr_t **g_pagemap[PM_FANOUT];
+
+/* Install a fresh node in *slot unless another thread beat us to it */
+static void *node_install(void **slot)
+{
+    void *node = os_map(PM_NODE_SIZE);
+    void *expected = NULL;
+
+    if (!node)
+        return NULL;
+    if (!__atomic_compare_exchange_n(slot, &expected, node, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        os_unmap(node, PM_NODE_SIZE);
+        return expected;
+    }
+    __atomic_fetch_add(&g_heap.stats.pagemap_bytes, PM_NODE_SIZE, __ATOMIC_RELAXED);
+    return node;
+}
+
+static uintptr_t *leaf_of(uintptr_t page, bool create)
+{
+    uintptr_t **mid;
+    uintptr_t *leaf;
+    size_t i1 = page >> (2 * PM_LEVEL_BITS);
+    size_t i2 = (page >> PM_LEVEL_BITS) & (PM_FANOUT - 1);
+
+    if (page >= PM_PAGES)
+        return NULL;
+    mid = __atomic_load_n(&g_pagemap[i1], __ATOMIC_ACQUIRE);
+    if (!mid && (!create || !(mid = node_install((void **)&g_pagemap[i1]))))
+        return NULL;
+    leaf = __atomic_load_n(&mid[i2], __ATOMIC_ACQUIRE);
+    if (!leaf && (!create || !(leaf = node_install((void **)&mid[i2]))))
+        return NULL;
+    return leaf;
+}
+
+static bool pagemap_fill(void *start, size_t len, uintptr_t entry, bool create)
+{
+    uintptr_t page = (uintptr_t)start >> PM_SHIFT;
+    uintptr_t last = ((uintptr_t)start + len - 1) >> PM_SHIFT;
+    uintptr_t *leaf;
+
+    while (page <= last)
+    {
+        leaf = leaf_of(page, create);
+        if (!leaf && create)
+            return false;
+        // Fill up to the end of this leaf in one go
+        do {
+            if (leaf)
+                __atomic_store_n(&leaf[page & (PM_FANOUT - 1)], entry, __ATOMIC_RELEASE);
+            page++;
+        } while (page <= last && (page & (PM_FANOUT - 1)));
+    }
+    return true;
+}
+
+bool pagemap_set(void *start, size_t len, void *owner, int kind)
+{
+    if (!pagemap_fill(start, len, (uintptr_t)owner | (uintptr_t)kind, true))
+    {
+        pagemap_clear(start, len);
+        return false;
+    }
+    return true;
+}
+
+void pagemap_clear(void *start, size_t len)
+{
+    pagemap_fill(start, len, 0, false);
+}
+
+uintptr_t pagemap_get(const void *addr)
+{
+    uintptr_t page = (uintptr_t)addr >> PM_SHIFT;
+    uintptr_t *leaf = leaf_of(page, false);
+
+    if (!leaf)
+        return 0;
+    return __atomic_load_n(&leaf[page & (PM_FANOUT - 1)], __ATOMIC_ACQUIRE);
+}
+
+/*
+    * Each owner is reported once, on the page holding the first byte after a
+    * LARGE header: the first page of a zone, the user page of a LARGE mapping
+    * (its header may end the previous page when the block is page aligned).
+*/
+#define REPORT_PAGE(owner) (((uintptr_t)(owner) + sizeof(t_large)) >> PM_SHIFT)
+
+/* Lowest owner of the given kind starting strictly after addr (NULL: from 0) */
+void *pagemap_next(int kind, const void *after)
+{
+    uintptr_t page = after ? REPORT_PAGE(after) + 1 : 0;
+    uintptr_t **mid;
+    uintptr_t *leaf;
+    uintptr_t entry;
+
+    while (page < PM_PAGES)
+    {
+        mid = __atomic_load_n(&g_pagemap[page >> (2 * PM_LEVEL_BITS)], __ATOMIC_ACQUIRE);
+        if (!mid)
+        {
+            page = ((page >> (2 * PM_LEVEL_BITS)) + 1) << (2 * PM_LEVEL_BITS);
+            continue;
+        }
+        leaf = __atomic_load_n(&mid[(page >> PM_LEVEL_BITS) & (PM_FANOUT - 1)], __ATOMIC_ACQUIRE);
+        if (!leaf)
+        {
+            page = ((page >> PM_LEVEL_BITS) + 1) << PM_LEVEL_BITS;
+            continue;
+        }
+        entry = __atomic_load_n(&leaf[page & (PM_FANOUT - 1)], __ATOMIC_ACQUIRE);
+        if (PAGEMAP_KIND(entry) == kind && REPORT_PAGE(PAGEMAP_OWNER(entry)) == page)
+            return PAGEMAP_OWNER(entry);
+        page++;
+    }
+    return NULL;
+}
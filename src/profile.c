@@ -0,0 +1,381 @@
+#include "../include/malloc.h"
+#include <execinfo.h>
+#include <fcntl.h>
+#include <string.h>
+
+/*
+    * Sampling heap profiler.
+    * Every thread counts down a random number of bytes, exponentially
+    * distributed around MALLOC_PROFILE_RATE, and records the call stack of
+    * the allocation that crosses zero. Samples are grouped by stack into
+    * buckets, and the blocks still held are kept in a table by address so
+    * free() can credit their bucket. Zones count their sampled blocks and
+    * LARGE headers carry a flag: an unsampled free never looks the table up.
+    * The dump is a gperftools heap_v2 profile, which pprof reads and scales
+    * back up by the rate: in-use and total-allocated figures in one file.
+    * Profiler memory comes from os_map(), never from malloc().
+*/
+
+typedef struct s_prof_thread {
+    int64_t         countdown;       // Bytes left before the next sample
+    uint64_t        rng;
+    bool            busy;            // Sampling: nested allocations are not sampled
+} t_prof_thread;
+
+static __thread t_prof_thread g_prof_thread __attribute__((tls_model("initial-exec")));
+
+static pthread_mutex_t  g_prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+static t_prof_bucket    **g_buckets;    // PROFILE_BUCKETS heads, mapped on first sample
+static t_prof_sample    **g_live;       // PROFILE_LIVE_SLOTS heads
+static t_prof_sample    *g_spare;       // Recycled sample records
+static char             *g_pool;        // Bump region for buckets and samples
+static size_t           g_pool_left;
+
+#define LIVE_SLOT(ptr) (((uintptr_t)(ptr) >> 4) * 0x9E3779B97F4A7C15ULL >> 51)
+
+/* Natural log of x in (0, 1], close enough for drawing intervals */
+static double fast_log(double x)
+{
+    union { double d; uint64_t u; } bits = { .d = x };
+    int exponent = (int)((bits.u >> 52) & 0x7FF) - 1023;
+    double t;
+
+    // x = m * 2^exponent with m in [1, 2): ln(m) by the atanh series
+    bits.u = (bits.u & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+    t = (bits.d - 1) / (bits.d + 1);
+    return exponent * 0.6931471805599453
+        + 2 * t * (1 + t * t * (1.0 / 3 + t * t * (1.0 / 5 + t * t / 7)));
+}
+
+/* Bytes until the next sample: exponential with mean rate, -ln(U) * rate */
+static int64_t next_interval(t_prof_thread *thread, size_t rate)
+{
+    uint64_t x = thread->rng;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    thread->rng = x;
+    return (int64_t)(-fast_log(((x >> 11) + 1) / 9007199254740992.0) * (double)rate) + 1;
+}
+
+/* Memory for the profiler's own records, g_prof_mutex held */
+static void *prof_alloc(size_t size)
+{
+    void *ptr;
+
+    if (g_pool_left < size)
+    {
+        if (!(g_pool = os_map(PROFILE_POOL_SIZE)))
+        {
+            g_pool_left = 0;
+            return NULL;
+        }
+        g_pool_left = PROFILE_POOL_SIZE;
+    }
+    ptr = g_pool;
+    g_pool += size;
+    g_pool_left -= size;
+    return ptr;
+}
+
+static t_prof_bucket *find_bucket(void **frames, int depth)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    t_prof_bucket *bucket;
+    size_t head;
+
+    for (int i = 0; i < depth; i++)
+        hash = (hash ^ (uintptr_t)frames[i]) * 0x100000001B3ULL;
+    head = hash % PROFILE_BUCKETS;
+    for (bucket = g_buckets[head]; bucket; bucket = bucket->next)
+    {
+        if (bucket->hash == hash && bucket->depth == depth
+            && !memcmp(bucket->frames, frames, depth * sizeof(void *)))
+            return bucket;
+    }
+    if (!(bucket = prof_alloc(sizeof(t_prof_bucket))))
+        return NULL;
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->hash = hash;
+    bucket->depth = depth;
+    memcpy(bucket->frames, frames, depth * sizeof(void *));
+    bucket->next = g_buckets[head];
+    g_buckets[head] = bucket;
+    return bucket;
+}
+
+/* Record one sample, false when the profiler ran out of memory */
+static bool record_sample(void *ptr, size_t size, void **frames, int depth)
+{
+    t_prof_bucket *bucket;
+    t_prof_sample *sample;
+
+    pthread_mutex_lock(&g_prof_mutex);
+    if (!g_buckets)
+    {
+        g_buckets = os_map(PROFILE_BUCKETS * sizeof(t_prof_bucket *));
+        g_live = os_map(PROFILE_LIVE_SLOTS * sizeof(t_prof_sample *));
+    }
+    if (!g_buckets || !g_live || !(bucket = find_bucket(frames, depth)))
+    {
+        pthread_mutex_unlock(&g_prof_mutex);
+        return false;
+    }
+    if ((sample = g_spare))
+        g_spare = sample->next;
+    else if (!(sample = prof_alloc(sizeof(t_prof_sample))))
+    {
+        pthread_mutex_unlock(&g_prof_mutex);
+        return false;
+    }
+    bucket->allocs++;
+    bucket->alloc_bytes += size;
+    sample->ptr = ptr;
+    sample->size = size;
+    sample->bucket = bucket;
+    sample->next = g_live[LIVE_SLOT(ptr)];
+    g_live[LIVE_SLOT(ptr)] = sample;
+    pthread_mutex_unlock(&g_prof_mutex);
+    return true;
+}
+
+/* Count size bytes against the calling thread, sample the block when its turn comes */
+void profile_alloc(void *ptr, size_t size, int kind)
+{
+    t_prof_thread *thread = &g_prof_thread;
+    size_t rate = __atomic_load_n(&g_heap.profile_rate, __ATOMIC_RELAXED);
+    void *frames[PROFILE_MAX_DEPTH + PROFILE_SKIP];
+    int depth;
+
+    if ((thread->countdown -= (int64_t)size) >= 0 || thread->busy || !rate)
+        return;
+
+    if (!thread->rng)
+    {
+        // First turn of this thread: draw its first interval, no sample
+        thread->rng = ((uintptr_t)thread ^ heap_clock()) | 1;
+        thread->countdown = next_interval(thread, rate);
+        return;
+    }
+
+    // backtrace() loads the unwinder on first use, which allocates
+    thread->busy = true;
+    depth = backtrace(frames, PROFILE_MAX_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;
+    if (depth > 0 && record_sample(ptr, size, frames + PROFILE_SKIP, depth))
+    {
+        if (kind == PAGE_LARGE)
+            ((t_large *)((char *)ptr - sizeof(t_large)))->sampled = true;
+        else
+            __atomic_fetch_add(&((t_zone *)PAGEMAP_OWNER(pagemap_get(ptr)))->sampled, 1, __ATOMIC_RELAXED);
+    }
+    thread->countdown = next_interval(thread, rate);
+    thread->busy = false;
+}
+
+static t_prof_sample *unlink_sample(void *ptr)
+{
+    t_prof_sample **link;
+    t_prof_sample *sample;
+
+    if (!g_live)
+        return NULL;
+    for (link = &g_live[LIVE_SLOT(ptr)]; (sample = *link); link = &sample->next)
+    {
+        if (sample->ptr == ptr)
+        {
+            *link = sample->next;
+            return sample;
+        }
+    }
+    return NULL;
+}
+
+/* The user released ptr: credit its bucket if it was sampled. Returns whether it was */
+bool profile_free(void *ptr)
+{
+    t_prof_sample *sample;
+
+    pthread_mutex_lock(&g_prof_mutex);
+    if ((sample = unlink_sample(ptr)))
+    {
+        sample->bucket->frees++;
+        sample->bucket->free_bytes += sample->size;
+        sample->next = g_spare;
+        g_spare = sample;
+    }
+    pthread_mutex_unlock(&g_prof_mutex);
+    return sample != NULL;
+}
+
+/* A sampled LARGE block was moved by mremap(), keep tracking it */
+void profile_move(void *old_ptr, void *new_ptr, size_t size)
+{
+    t_prof_sample *sample;
+
+    pthread_mutex_lock(&g_prof_mutex);
+    if ((sample = unlink_sample(old_ptr)))
+    {
+        sample->bucket->alloc_bytes += size - sample->size;
+        sample->ptr = new_ptr;
+        sample->size = size;
+        sample->next = g_live[LIVE_SLOT(new_ptr)];
+        g_live[LIVE_SLOT(new_ptr)] = sample;
+    }
+    pthread_mutex_unlock(&g_prof_mutex);
+}
+
+/* Change the mean sampling interval at run time, 0 stops sampling */
+void malloc_profile_set_rate(size_t rate)
+{
+    heap_init();
+    __atomic_store_n(&g_heap.profile_rate, rate, __ATOMIC_RELAXED);
+}
+
+/* Buffered writes to the profile file, nothing more is written after a failure */
+typedef struct s_prof_out {
+    int             fd;
+    bool            failed;
+    size_t          len;
+    char            buf[4096];
+} t_prof_out;
+
+static void out_flush(t_prof_out *out)
+{
+    if (out->len && !out->failed && write(out->fd, out->buf, out->len) < 0)
+        out->failed = true;
+    out->len = 0;
+}
+
+static void out_str(t_prof_out *out, const char *s)
+{
+    for (; *s; s++)
+    {
+        if (out->len == sizeof(out->buf))
+            out_flush(out);
+        out->buf[out->len++] = *s;
+    }
+}
+
+static void out_num(t_prof_out *out, uintptr_t n, unsigned base)
+{
+    char digits[24];
+    int i = (int)sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+        digits[--i] = "0123456789abcdef"[n % base];
+    while ((n /= base));
+    out_str(out, digits + i);
+}
+
+/* "<in use count>: <in use bytes> [<allocated count>: <allocated bytes>]" */
+static void out_counts(t_prof_out *out, size_t live, size_t live_bytes, size_t total, size_t total_bytes)
+{
+    out_num(out, live, 10);
+    out_str(out, ": ");
+    out_num(out, live_bytes, 10);
+    out_str(out, " [");
+    out_num(out, total, 10);
+    out_str(out, ": ");
+    out_num(out, total_bytes, 10);
+    out_str(out, "]");
+}
+
+/* Write the profile to path, or to the MALLOC_PROFILE path. 0 on success, -1 otherwise */
+int malloc_profile_dump(const char *path)
+{
+    size_t totals[4] = {0};
+    t_prof_out out;
+    char maps[4096];
+    ssize_t got;
+    int fd;
+
+    if (!path)
+        path = g_heap.profile_path;
+    if (!path || (out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    out.failed = false;
+    out.len = 0;
+
+    pthread_mutex_lock(&g_prof_mutex);
+    for (size_t i = 0; g_buckets && i < PROFILE_BUCKETS; i++)
+    {
+        for (t_prof_bucket *b = g_buckets[i]; b; b = b->next)
+        {
+            totals[0] += b->allocs - b->frees;
+            totals[1] += b->alloc_bytes - b->free_bytes;
+            totals[2] += b->allocs;
+            totals[3] += b->alloc_bytes;
+        }
+    }
+    out_str(&out, "heap profile: ");
+    out_counts(&out, totals[0], totals[1], totals[2], totals[3]);
+    out_str(&out, " @ heap_v2/");
+    out_num(&out, g_heap.profile_rate ? g_heap.profile_rate : DEFAULT_PROFILE_RATE, 10);
+    out_str(&out, "\n");
+    for (size_t i = 0; g_buckets && i < PROFILE_BUCKETS; i++)
+    {
+        for (t_prof_bucket *b = g_buckets[i]; b; b = b->next)
+        {
+            out_counts(&out, b->allocs - b->frees, b->alloc_bytes - b->free_bytes, b->allocs, b->alloc_bytes);
+            out_str(&out, " @");
+            for (int f = 0; f < b->depth; f++)
+            {
+                out_str(&out, " 0x");
+                out_num(&out, (uintptr_t)b->frames[f], 16);
+            }
+            out_str(&out, "\n");
+        }
+    }
+    pthread_mutex_unlock(&g_prof_mutex);
+
+    // pprof symbolizes the addresses with the process' mappings
+    out_str(&out, "\nMAPPED_LIBRARIES:\n");
+    out_flush(&out);
+    if ((fd = open("/proc/self/maps", O_RDONLY)) >= 0)
+    {
+        while (!out.failed && (got = read(fd, maps, sizeof(maps))) > 0)
+        {
+            if (write(out.fd, maps, got) < 0)
+                out.failed = true;
+        }
+        close(fd);
+    }
+    close(out.fd);
+    return out.failed ? -1 : 0;
+}
+
+/* <base>.<pid><suffix> into dst, false when it does not fit */
+bool pid_path(char *dst, size_t cap, const char *base, const char *suffix)
+{
+    size_t len = strlen(base);
+    size_t suffix_len = strlen(suffix);
+    pid_t pid = getpid();
+    char digits[16];
+    int i = (int)sizeof(digits);
+
+    do
+        digits[--i] = (char)('0' + pid % 10);
+    while ((pid /= 10));
+    if (len + 1 + (sizeof(digits) - i) + suffix_len + 1 > cap)
+        return false;
+    memcpy(dst, base, len);
+    dst[len++] = '.';
+    memcpy(dst + len, digits + i, sizeof(digits) - i);
+    len += sizeof(digits) - i;
+    memcpy(dst + len, suffix, suffix_len + 1);
+    return true;
+}
+
+/* With MALLOC_PROFILE set, write <path>.<pid>.heap when the process exits */
+__attribute__((destructor))
+static void profile_at_exit(void)
+{
+    char path[4096];
+
+    if (!g_heap.profile_path || !g_buckets)
+        return;
+    if (pid_path(path, sizeof(path), g_heap.profile_path, ".heap"))
+        malloc_profile_dump(path);
+}
@@ -1,81 +1,136 @@
 #include "../include/malloc.h"
 
-static bool is_large_block(t_block *block)
+/* Grow a LARGE mapping in place or let mremap() move it, the owning arena must be locked */
+static void *realloc_large(void *ptr, t_large *large, size_t size)
 {
-    t_block *cur = g_heap.large;
-    while (cur) {
-        if (cur == block)
-            return true;
-        cur = cur->next;
+    // The mapping starts at the header's page, aligned blocks sit further in
+    char *base = (char *)((uintptr_t)large & ~(uintptr_t)(PAGE_SIZE - 1));
+    size_t offset = (char *)ptr - base;
+    size_t old_total = (size_t)large->pages * PAGE_SIZE;
+    size_t new_pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t new_total = new_pages * PAGE_SIZE;
+
+    // Unregister first: once moved, the old range may be mapped and
+    // registered by another thread before we get to clear it
+    pagemap_clear(ptr, ALIGNMENT);
+    __atomic_fetch_add(&g_heap.stats.mmap_calls, 1, __ATOMIC_RELAXED);
+    char *new_base = mremap(base, old_total, new_total, MREMAP_MAYMOVE);
+    if (new_base == MAP_FAILED)
+    {
+        pagemap_set(ptr, ALIGNMENT, large, PAGE_LARGE);
+        return NULL;
     }
-    return false;
+    __atomic_fetch_add(&g_heap.stats.bytes_mapped, new_total - old_total, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_heap.stats.large_mapped, new_total - old_total, __ATOMIC_RELAXED);
+    stats_free(PAGE_LARGE, old_total - offset);
+    stats_alloc(PAGE_LARGE, new_total - offset);
+
+    // Register the mapping again, it may have moved or grown
+    t_large *new_large = (t_large *)(new_base + offset - sizeof(t_large));
+    pagemap_set(new_base + offset, ALIGNMENT, new_large, PAGE_LARGE);
+    new_large->size = size;
+    new_large->pages = (uint32_t)new_pages;
+    if (new_large->sampled)
+        profile_move(ptr, new_base + offset, new_total - offset);
+    return (void *)(new_base + offset);
 }
 
-void *realloc(void *ptr, size_t size)
+static void *resize(void *ptr, size_t size)
 {
-    t_block *block;
+    t_arena *arena;
+    uintptr_t owner;
+    size_t usable;
+    size_t dirty;
     void *new_ptr;
 
     if (!ptr)
-        return malloc(size);
+        return heap_alloc(size, &dirty);
 
     if (size == 0)
     {
-        free(ptr);
+        heap_free(ptr);
         return NULL;
     }
 
-    size = ALIGN(size);
-    block = (t_block *)((char *)ptr - sizeof(t_block));
-    
-    if (block->size >= size)
-        return ptr;
+    owner = pagemap_get(ptr);
+    if (!owner)
+        return NULL;
+
+    if (PAGEMAP_KIND(owner) == PAGE_LARGE)
+    {
+        t_large *large = (t_large *)((char *)ptr - sizeof(t_large));
 
-    pthread_mutex_lock(&g_heap.mutex);
-    
-    // Optimisation pour LARGE blocks : utiliser mremap() si possible
-    if (is_large_block(block) && size > SMALL_MAX)
+        if (PAGEMAP_OWNER(owner) != large)
+            return NULL;
+        // Shrinking or growing into the slack of the last page keeps the
+        // mapping. A SMALL size moves to a zone: free_sized() counts on
+        // LARGE blocks never holding one
+        if (size > SMALL_MAX && size <= malloc_usable_size(ptr))
+        {
+            large->size = size;
+            return ptr;
+        }
+        usable = large->size;
+        if (size > SMALL_MAX && size <= MAX_ALLOC_SIZE)
+        {
+            arena = &g_heap.arenas[large->arena];
+            pthread_mutex_lock(&arena->mutex);
+            new_ptr = realloc_large(ptr, large, ALIGN(size));
+            pthread_mutex_unlock(&arena->mutex);
+            if (new_ptr)
+                return new_ptr;
+        }
+    }
+    else
     {
-        size_t old_total = sizeof(t_block) + block->size;
-        size_t new_total = sizeof(t_block) + size;
-        
-        void *new_block = mremap(block, old_total, new_total, MREMAP_MAYMOVE);
-        if (new_block != MAP_FAILED)
+        t_zone *zone = PAGEMAP_OWNER(owner);
+
+        // SMALL blocks grow into a free neighbour or shrink in place
+        if (PAGEMAP_KIND(owner) == PAGE_SMALL && size <= SMALL_MAX
+            && BLOCK_SIZE(size) != BLOCK_OF(ptr)->size)
         {
-            if (new_block != block)
+            size_t old = BLOCK_OF(ptr)->size - sizeof(t_block);
+
+            arena = arena_of(zone);
+            pthread_mutex_lock(&arena->mutex);
+            bool resized = resize_block(zone, BLOCK_OF(ptr), BLOCK_SIZE(size));
+            pthread_mutex_unlock(&arena->mutex);
+            // Counted as a free and an allocation, the block may change class
+            if (resized)
             {
-                t_block *prev = NULL;
-                t_block *cur = g_heap.large;
-                while (cur && cur != block)
-                {
-                    prev = cur;
-                    cur = cur->next;
-                }
-                if (cur)
-                {
-                    if (prev)
-                        prev->next = (t_block *)new_block;
-                    else
-                        g_heap.large = (t_block *)new_block;
-                    
-                    ((t_block *)new_block)->next = cur->next;
-                }
+                stats_free(PAGE_SMALL, old);
+                stats_alloc(PAGE_SMALL, BLOCK_OF(ptr)->size - sizeof(t_block));
+                return ptr;
             }
-            
-            ((t_block *)new_block)->size = size;
-            pthread_mutex_unlock(&g_heap.mutex);
-            return (void *)((char *)new_block + sizeof(t_block));
         }
+
+        // TINY slots keep their pointer while the size stays in their class,
+        // so the block always matches what free_sized() is told
+        usable = malloc_usable_size(ptr);
+        if (size <= usable && (zone->size_class >= TINY_CLASSES
+            || tiny_class(ALIGN(size)) == zone->size_class))
+            return ptr;
     }
-    
-    pthread_mutex_unlock(&g_heap.mutex);
-    
+
     // Fallback vers l'ancienne méthode
-    new_ptr = malloc(size);
+    new_ptr = heap_alloc(size, &dirty);
     if (!new_ptr)
         return NULL;
 
-    ft_memcpy(new_ptr, ptr, block->size);
-    free(ptr);
+    ft_memcpy(new_ptr, ptr, size < usable ? size : usable);
+    heap_free(ptr);
+    return new_ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    uint64_t start;
+    void *new_ptr;
+
+    if (!g_heap.tracing)
+        return resize(ptr, size);
+    start = trace_clock();
+    new_ptr = resize(ptr, size);
+    trace_realloc(ptr, new_ptr, size, start);
     return new_ptr;
 }
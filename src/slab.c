@@ -0,0 +1,230 @@
+#include "../include/malloc.h"
+
+/*
+    * TINY slab allocator.
+    * A slab is a TINY zone dedicated to one size class and carved into equal
+    * slots with no header: everything a slot needs to know is its zone's
+    * (class, arena), and a bit in the zone's live bitmap says whether the
+    * user holds it. Slots are carved lazily with a bump counter, so untouched
+    * pages are never faulted in. Freed slots are pushed on the zone's free
+    * list through their first bytes. Slab zones are mapped aligned to their
+    * size, so a slot's zone can also be found by masking its address.
+*/
+
+static const size_t g_class_size[TINY_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512
+};
+
+#define SLOT_NEXT(slot) (*(void **)(slot))
+
+/* Slots start on a 256-byte boundary so that classes of 32 to 256 bytes keep their natural alignment */
+#define SLAB_HEADER     ((sizeof(t_zone) + 255) & ~(size_t)255)
+#define SLAB_DATA(zone) ((char *)(zone) + SLAB_HEADER)
+
+/* Class index for an aligned TINY size */
+size_t tiny_class(size_t size)
+{
+    if (size <= 128)
+        return size / ALIGNMENT - 1;
+    if (size <= 256)
+        return 8 + (size - 129) / 32;
+    return 12 + (size - 257) / 64;
+}
+
+size_t tiny_class_size(size_t size_class)
+{
+    return g_class_size[size_class];
+}
+
+/* Smallest class holding size whose slots all start on an alignment boundary, TINY_CLASSES if none */
+size_t tiny_aligned_class(size_t size, size_t alignment)
+{
+    if (SLAB_HEADER % alignment)
+        return TINY_CLASSES;
+    for (size_t size_class = tiny_class(size); size_class < TINY_CLASSES; size_class++)
+    {
+        if (g_class_size[size_class] % alignment == 0)
+            return size_class;
+    }
+    return TINY_CLASSES;
+}
+
+/* Smallest power-of-two multiple of TINY_ZONE_SIZE holding SLAB_MIN_SLOTS slots */
+static size_t slab_zone_size(size_t size_class)
+{
+    size_t want = SLAB_HEADER + SLAB_MIN_SLOTS * g_class_size[size_class];
+    size_t zone_size = TINY_ZONE_SIZE;
+
+    while (zone_size < want)
+        zone_size <<= 1;
+    return zone_size;
+}
+
+/* Index of the slot at ptr, or capacity when ptr is not the start of a slot */
+static size_t slot_index(t_zone *zone, void *ptr)
+{
+    size_t offset = (size_t)((char *)ptr - SLAB_DATA(zone));
+    size_t index = offset / g_class_size[zone->size_class];
+
+    if ((char *)ptr < SLAB_DATA(zone) || offset % g_class_size[zone->size_class])
+        return zone->capacity;
+    return index < zone->capacity ? index : zone->capacity;
+}
+
+static void set_live(t_zone *zone, size_t index)
+{
+    __atomic_fetch_or(&zone->live[index / 64], 1UL << (index % 64), __ATOMIC_RELAXED);
+}
+
+/*
+    * The user gives a slot back: clear its live bit. False when it was not
+    * live, a double free or a pointer into the middle of a slot.
+*/
+bool slot_release(t_zone *zone, void *ptr)
+{
+    size_t index = slot_index(zone, ptr);
+    uint64_t bit = 1UL << (index % 64);
+
+    if (index >= zone->capacity)
+        return false;
+    return __atomic_fetch_and(&zone->live[index / 64], ~bit, __ATOMIC_RELAXED) & bit;
+}
+
+/* A released slot goes back to the user straight from a thread cache */
+void slot_reuse(void *ptr, size_t size_class)
+{
+    size_t zone_size = slab_zone_size(size_class);
+    t_zone *zone = (t_zone *)((uintptr_t)ptr & ~(uintptr_t)(zone_size - 1));
+
+    set_live(zone, slot_index(zone, ptr));
+}
+
+static void avail_push(t_arena *arena, t_zone *zone)
+{
+    t_zone **head = &arena->tiny_avail[zone->size_class];
+
+    zone->avail_prev = NULL;
+    zone->avail_next = *head;
+    if (*head)
+        (*head)->avail_prev = zone;
+    *head = zone;
+}
+
+static void avail_remove(t_arena *arena, t_zone *zone)
+{
+    if (zone->avail_prev)
+        zone->avail_prev->avail_next = zone->avail_next;
+    else
+        arena->tiny_avail[zone->size_class] = zone->avail_next;
+    if (zone->avail_next)
+        zone->avail_next->avail_prev = zone->avail_prev;
+    zone->avail_prev = NULL;
+    zone->avail_next = NULL;
+}
+
+static t_zone *create_slab(t_arena *arena, size_t size_class)
+{
+    size_t zone_size = slab_zone_size(size_class);
+    t_zone *zone;
+    bool zeroed;
+
+    zone = zone_map(zone_size, &zeroed);
+    if (!zone)
+        return NULL;
+    if (!pagemap_set(zone, zone_size, zone, PAGE_TINY))
+    {
+        zone_unmap(zone, zone_size);
+        return NULL;
+    }
+
+    zone->size = zone_size;
+    zone->blocks = NULL;
+    zone->used = 0;
+    zone->size_class = size_class;
+    zone->arena = arena->index;
+    zone->capacity = (zone_size - SLAB_HEADER) / g_class_size[size_class];
+    if (zone->capacity > SLAB_MAX_SLOTS)
+        zone->capacity = SLAB_MAX_SLOTS;
+    for (size_t i = 0; i < SLAB_MAX_SLOTS / 64; i++)
+        zone->live[i] = 0;
+    zone->carved = 0;
+    zone->free_slots = NULL;
+    zone->clean = (char *)zone + (zeroed ? 0 : zone_size);
+    zone->sampled = 0;
+    __atomic_fetch_add(&g_heap.stats.zones_created, 1, __ATOMIC_RELAXED);
+
+    link_zone(&arena->tiny, zone);
+    avail_push(arena, zone);
+    arena->empty_zones[size_class]++;
+    return zone;
+}
+
+static bool slab_full(t_zone *zone)
+{
+    return !zone->free_slots && zone->carved == zone->capacity;
+}
+
+void *allocate_slab(t_arena *arena, size_t size_class, size_t *dirty)
+{
+    t_zone *zone;
+    char *slot;
+    size_t index;
+
+    zone = arena->tiny_avail[size_class];
+    if (!zone && !(zone = create_slab(arena, size_class)))
+        return NULL;
+
+    if (zone->free_slots)
+    {
+        slot = zone->free_slots;
+        zone->free_slots = SLOT_NEXT(slot);
+        index = (size_t)(slot - SLAB_DATA(zone)) / g_class_size[size_class];
+        *dirty = g_class_size[size_class];
+    }
+    else
+    {
+        // Carve the next slot
+        index = zone->carved++;
+        slot = SLAB_DATA(zone) + index * g_class_size[size_class];
+        // Never handed out: still zero unless the chunk units were recycled
+        *dirty = slot >= zone->clean ? 0 : g_class_size[size_class];
+    }
+
+    if (slab_full(zone))
+        avail_remove(arena, zone);
+    if (zone->used++ == 0)
+        arena->empty_zones[size_class]--;
+
+    set_live(zone, index);
+    return slot;
+}
+
+/* Address of slot index if the user holds it, NULL otherwise */
+void *live_slot(t_zone *zone, size_t index)
+{
+    if (!(__atomic_load_n(&zone->live[index / 64], __ATOMIC_RELAXED) & (1UL << (index % 64))))
+        return NULL;
+    return SLAB_DATA(zone) + index * g_class_size[zone->size_class];
+}
+
+/* Put a released slot back on its zone's free list, the owning arena must be locked */
+void slab_free(t_zone *zone, void *ptr)
+{
+    t_arena *arena = arena_of(zone);
+    bool was_full = slab_full(zone);
+
+    SLOT_NEXT(ptr) = zone->free_slots;
+    zone->free_slots = ptr;
+
+    if (was_full)
+        avail_push(arena, zone);
+
+    // Last slot of the slab: keep it as a spare or unmap it
+    if (--zone->used == 0 && zone_emptied(arena, zone->size_class))
+    {
+        avail_remove(arena, zone);
+        unmap_zone(&arena->tiny, zone);
+    }
+}
@@ -0,0 +1,257 @@
+#include "../include/malloc.h"
+#include <string.h>
+
+/*
+    * Allocation statistics.
+    * Each thread counts its allocations and frees per size class in a
+    * thread-local block that only it writes, so the hot path pays for a few
+    * plain stores. Blocks of live threads are chained for the readers; an
+    * exiting thread folds its counts into g_retired and unlinks itself.
+    * A block is often freed by another thread than the one that allocated
+    * it: only the sums over all threads mean something.
+    * Mapping, zone and LARGE counters are kept in g_heap.stats with relaxed
+    * atomics where the events happen, they are rare.
+*/
+
+static __thread t_thread_stats g_thread_stats __attribute__((tls_model("initial-exec")));
+
+static t_thread_stats   g_retired;      // Exited threads, and threads past their exit
+static t_thread_stats   *g_threads;     // Live threads, guarded by g_stats_mutex
+static pthread_mutex_t  g_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t    g_stats_key;
+static pthread_once_t   g_stats_once = PTHREAD_ONCE_INIT;
+
+// Single writer: a relaxed load/add/store, no locked instruction
+#define BUMP(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#define READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define HEAP_STAT(name) __atomic_load_n(&g_heap.stats.name, __ATOMIC_RELAXED)
+
+static void fold_into_retired(t_thread_stats *stats)
+{
+    for (size_t i = 0; i < STAT_CLASSES; i++)
+    {
+        __atomic_fetch_add(&g_retired.allocs[i], stats->allocs[i], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_retired.frees[i], stats->frees[i], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_retired.bytes_allocated[i], stats->bytes_allocated[i], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_retired.bytes_freed[i], stats->bytes_freed[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void stats_thread_exit(void *arg)
+{
+    t_thread_stats *stats = (t_thread_stats *)arg;
+
+    pthread_mutex_lock(&g_stats_mutex);
+    if (stats->prev)
+        stats->prev->next = stats->next;
+    else
+        g_threads = stats->next;
+    if (stats->next)
+        stats->next->prev = stats->prev;
+    fold_into_retired(stats);
+    // Frees made by later TSD destructors go straight to g_retired
+    stats->state = STATS_DEAD;
+    pthread_mutex_unlock(&g_stats_mutex);
+}
+
+static void stats_create_key(void)
+{
+    pthread_key_create(&g_stats_key, stats_thread_exit);
+}
+
+/* The calling thread's counters, or NULL once it is exiting */
+static t_thread_stats *thread_stats(void)
+{
+    t_thread_stats *stats = &g_thread_stats;
+
+    if (stats->state == STATS_ACTIVE)
+        return stats;
+    if (stats->state == STATS_DEAD)
+        return NULL;
+
+    // Mark active first: pthread_setspecific() may itself call malloc/free
+    stats->state = STATS_ACTIVE;
+    pthread_once(&g_stats_once, stats_create_key);
+    pthread_mutex_lock(&g_stats_mutex);
+    stats->prev = NULL;
+    stats->next = g_threads;
+    if (g_threads)
+        g_threads->prev = stats;
+    g_threads = stats;
+    pthread_mutex_unlock(&g_stats_mutex);
+    if (pthread_setspecific(g_stats_key, stats) != 0)
+    {
+        stats_thread_exit(stats);
+        return NULL;
+    }
+    return stats;
+}
+
+static size_t stat_class(int kind, size_t usable)
+{
+    size_t range;
+
+    if (kind == PAGE_TINY)
+        return tiny_class(usable);
+    if (kind == PAGE_LARGE)
+        return STAT_LARGE_CLASS;
+    range = (usable - 1) / STAT_SMALL_STEP;
+    return TINY_CLASSES + (range < STAT_SMALL_CLASSES ? range : STAT_SMALL_CLASSES - 1);
+}
+
+void stats_alloc(int kind, size_t usable)
+{
+    t_thread_stats *stats = thread_stats();
+    size_t i = stat_class(kind, usable);
+
+    if (!stats)
+    {
+        __atomic_fetch_add(&g_retired.allocs[i], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_retired.bytes_allocated[i], usable, __ATOMIC_RELAXED);
+        return;
+    }
+    BUMP(stats->allocs[i], 1);
+    BUMP(stats->bytes_allocated[i], usable);
+}
+
+void stats_free(int kind, size_t usable)
+{
+    t_thread_stats *stats = thread_stats();
+    size_t i = stat_class(kind, usable);
+
+    if (!stats)
+    {
+        __atomic_fetch_add(&g_retired.frees[i], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_retired.bytes_freed[i], usable, __ATOMIC_RELAXED);
+        return;
+    }
+    BUMP(stats->frees[i], 1);
+    BUMP(stats->bytes_freed[i], usable);
+}
+
+/* Usable bytes of a LARGE block: the rest of its mapping */
+size_t large_usable(t_large *large, void *ptr)
+{
+    char *base = (char *)((uintptr_t)large & ~(uintptr_t)(PAGE_SIZE - 1));
+
+    return (size_t)large->pages * PAGE_SIZE - ((char *)ptr - base);
+}
+
+static void add_thread(t_malloc_stats *out, t_thread_stats *stats)
+{
+    for (size_t i = 0; i < STAT_CLASSES; i++)
+    {
+        out->classes[i].allocs += READ(stats->allocs[i]);
+        out->classes[i].frees += READ(stats->frees[i]);
+        out->classes[i].bytes_allocated += READ(stats->bytes_allocated[i]);
+        out->classes[i].bytes_freed += READ(stats->bytes_freed[i]);
+    }
+}
+
+void malloc_get_stats(t_malloc_stats *out)
+{
+    size_t small_blocks = 0;
+    size_t large_blocks;
+
+    if (!out)
+        return;
+    memset(out, 0, sizeof(*out));
+
+    pthread_mutex_lock(&g_stats_mutex);
+    add_thread(out, &g_retired);
+    for (t_thread_stats *stats = g_threads; stats; stats = stats->next)
+        add_thread(out, stats);
+    pthread_mutex_unlock(&g_stats_mutex);
+
+    for (size_t i = 0; i < STAT_CLASSES; i++)
+    {
+        t_class_stats *class = &out->classes[i];
+
+        if (i < TINY_CLASSES)
+            class->size = tiny_class_size(i);
+        else if (i < STAT_LARGE_CLASS)
+            class->size = (i - TINY_CLASSES + 1) * STAT_SMALL_STEP;
+        out->allocs += class->allocs;
+        out->frees += class->frees;
+        // Counters of different threads are read at slightly different times
+        if (class->bytes_allocated > class->bytes_freed)
+            out->bytes_in_use += class->bytes_allocated - class->bytes_freed;
+        if (i >= TINY_CLASSES && i < STAT_LARGE_CLASS && class->allocs > class->frees)
+            small_blocks += class->allocs - class->frees;
+    }
+    // The last SMALL range holds blocks up to SMALL_MAX plus rounding
+    out->classes[STAT_LARGE_CLASS - 1].size = BLOCK_SIZE(SMALL_MAX) - sizeof(t_block);
+    t_class_stats *large = &out->classes[STAT_LARGE_CLASS];
+    large_blocks = large->allocs > large->frees ? large->allocs - large->frees : 0;
+
+    out->bytes_mapped = HEAP_STAT(bytes_mapped);
+    out->large_mapped = HEAP_STAT(large_mapped);
+    out->zones_created = HEAP_STAT(zones_created);
+    out->zones_released = HEAP_STAT(zones_released);
+    out->large_mmaps = HEAP_STAT(large_mmaps);
+    out->large_munmaps = HEAP_STAT(large_munmaps);
+    out->large_cache_hits = HEAP_STAT(large_hits);
+    out->large_cache_misses = HEAP_STAT(large_misses);
+    out->mmap_calls = HEAP_STAT(mmap_calls);
+    out->munmap_calls = HEAP_STAT(munmap_calls);
+
+    // Zone and chunk headers, block headers, the page map and the heap itself
+    out->metadata = sizeof(g_heap) + HEAP_STAT(pagemap_bytes)
+        + HEAP_STAT(chunks) * CHUNK_UNIT
+        + (out->zones_created - out->zones_released) * sizeof(t_zone)
+        + small_blocks * sizeof(t_block) + large_blocks * sizeof(t_large);
+}
+
+struct mallinfo2 mallinfo2(void)
+{
+    struct mallinfo2 info;
+    t_malloc_stats stats;
+
+    malloc_get_stats(&stats);
+    memset(&info, 0, sizeof(info));
+    t_class_stats *large = &stats.classes[STAT_LARGE_CLASS];
+    // A cross-thread free can be counted before its allocation, as in malloc_get_stats()
+    size_t large_in_use = large->bytes_allocated > large->bytes_freed
+        ? large->bytes_allocated - large->bytes_freed : 0;
+
+    info.hblks = large->allocs > large->frees ? large->allocs - large->frees : 0;
+    info.hblkhd = stats.large_mapped;
+    info.arena = stats.bytes_mapped - stats.large_mapped;
+    info.uordblks = stats.bytes_in_use > large_in_use ? stats.bytes_in_use - large_in_use : 0;
+    info.fordblks = info.arena > info.uordblks ? info.arena - info.uordblks : 0;
+    return info;
+}
+
+static void put_stat(const char *label, size_t n)
+{
+    char buf[64];
+    size_t len = strlen(label);
+    char digits[32];
+    int i = 0;
+
+    memcpy(buf, label, len);
+    do
+        digits[i++] = (char)('0' + n % 10);
+    while ((n /= 10));
+    while (i)
+        buf[len++] = digits[--i];
+    buf[len++] = '\n';
+    write(2, buf, len);
+}
+
+/* glibc-style summary on stderr */
+void malloc_stats(void)
+{
+    t_malloc_stats stats;
+
+    malloc_get_stats(&stats);
+    put_stat("system bytes     = ", stats.bytes_mapped);
+    put_stat("in use bytes     = ", stats.bytes_in_use);
+    put_stat("metadata bytes   = ", stats.metadata);
+    put_stat("allocations      = ", stats.allocs);
+    put_stat("frees            = ", stats.frees);
+    put_stat("zones created    = ", stats.zones_created);
+    put_stat("zones released   = ", stats.zones_released);
+    put_stat("mmap regions     = ", stats.large_mmaps - stats.large_munmaps);
+    put_stat("mmap bytes       = ", stats.large_mapped);
+}
@@ -0,0 +1,151 @@
+#include "../include/malloc.h"
+
+/*
+    * Per-thread cache of freed TINY/SMALL blocks.
+    * Cached blocks stay allocated from the zone's point of view (not on its
+    * free lists) so nobody else can hand them out; the cache only borrows the
+    * first bytes of the user area to chain them. Bins are indexed by usable
+    * size plus a header: TINY classes are multiples of ALIGNMENT and SMALL
+    * blocks hold a multiple minus their header, so both land on exact bins,
+    * TINY ones up to TINY_MAX / ALIGNMENT and SMALL ones above.
+*/
+
+static __thread t_tcache g_tcache __attribute__((tls_model("initial-exec")));
+
+static pthread_key_t    g_tcache_key;
+static pthread_once_t   g_tcache_once = PTHREAD_ONCE_INIT;
+
+#define TCACHE_NEXT(ptr) (*(void **)(ptr))
+#define TCACHE_BIN(size) (((size) + sizeof(t_block)) / ALIGNMENT)
+
+/*
+    * Give blocks back to their zones, locking each owning arena once per run.
+    * A busy arena is never waited for: its blocks go to its remote-free queue.
+*/
+static void release_chain(void *ptr)
+{
+    void *next;
+    t_arena *current = NULL;
+    bool locked = false;
+    t_arena *arena;
+    t_zone *zone;
+
+    while (ptr)
+    {
+        next = TCACHE_NEXT(ptr);
+        zone = PAGEMAP_OWNER(pagemap_get(ptr));
+        arena = arena_of(zone);
+        if (arena != current)
+        {
+            if (locked)
+                pthread_mutex_unlock(&current->mutex);
+            current = arena;
+            locked = pthread_mutex_trylock(&arena->mutex) == 0;
+            if (locked)
+                drain_remote_frees(arena);
+        }
+        if (locked)
+            release_block(zone, ptr);
+        else
+            remote_free(arena, ptr);
+        ptr = next;
+    }
+    if (locked)
+        pthread_mutex_unlock(&current->mutex);
+}
+
+static void tcache_drain(t_tcache *cache)
+{
+    for (size_t i = 0; i < TCACHE_BINS; i++)
+    {
+        release_chain(cache->bins[i]);
+        cache->bins[i] = NULL;
+        cache->counts[i] = 0;
+    }
+}
+
+static void tcache_thread_exit(void *arg)
+{
+    t_tcache *cache = (t_tcache *)arg;
+
+    // Anything freed by later TSD destructors goes straight to the heap
+    cache->state = TCACHE_DEAD;
+    tcache_drain(cache);
+}
+
+static void tcache_create_key(void)
+{
+    pthread_key_create(&g_tcache_key, tcache_thread_exit);
+}
+
+static bool tcache_init(void)
+{
+    // Mark active first: pthread_setspecific() may itself call malloc/free
+    g_tcache.state = TCACHE_ACTIVE;
+    pthread_once(&g_tcache_once, tcache_create_key);
+    if (pthread_setspecific(g_tcache_key, &g_tcache) != 0)
+    {
+        g_tcache.state = TCACHE_DEAD;
+        return false;
+    }
+    return true;
+}
+
+/* Return the oldest TCACHE_FLUSH_BATCH blocks of a full bin to the heap */
+static void tcache_flush_bin(size_t bin)
+{
+    void *keep = g_tcache.bins[bin];
+    void *batch;
+
+    for (size_t i = 1; i < (size_t)g_tcache.counts[bin] - TCACHE_FLUSH_BATCH; i++)
+        keep = TCACHE_NEXT(keep);
+    batch = TCACHE_NEXT(keep);
+    TCACHE_NEXT(keep) = NULL;
+    g_tcache.counts[bin] -= TCACHE_FLUSH_BATCH;
+
+    release_chain(batch);
+}
+
+/* size is the usable size wanted: a TINY class or the capacity of a SMALL block */
+void *tcache_get(size_t size)
+{
+    size_t  bin = TCACHE_BIN(size);
+    void    *ptr;
+
+    if (g_tcache.state != TCACHE_ACTIVE)
+        return NULL;
+
+    ptr = g_tcache.bins[bin];
+    if (!ptr)
+        return NULL;
+
+    g_tcache.bins[bin] = TCACHE_NEXT(ptr);
+    g_tcache.counts[bin]--;
+    if (size <= TINY_MAX)
+        slot_reuse(ptr, tiny_class(size));
+    else
+        BLOCK_OF(ptr)->in_tcache = false;
+    return ptr;
+}
+
+/* Park a block the user released, size is its usable size */
+bool tcache_put(void *ptr, size_t size)
+{
+    size_t bin = TCACHE_BIN(size);
+
+    if (!g_heap.tcache_enabled || bin >= TCACHE_BINS)
+        return false;
+    if (g_tcache.state != TCACHE_ACTIVE)
+    {
+        if (g_tcache.state == TCACHE_DEAD || !tcache_init())
+            return false;
+    }
+
+    if (g_tcache.counts[bin] >= TCACHE_BIN_MAX)
+        tcache_flush_bin(bin);
+
+    TCACHE_NEXT(ptr) = g_tcache.bins[bin];
+    g_tcache.bins[bin] = ptr;
+    g_tcache.counts[bin]++;
+    return true;
+}
@@ -0,0 +1,298 @@
+#include "../include/malloc.h"
+#include <fcntl.h>
+#include <sys/uio.h>
+
+/*
+    * Allocation trace.
+    * While tracing, malloc, calloc, the aligned allocators, realloc and free
+    * append one event each to a buffer of the calling thread: an op byte,
+    * then varints for the time since the thread's previous event, the size
+    * and the pointers as signed deltas from the thread's previous pointer.
+    * A typical event takes 5 to 10 bytes and no lock. Full buffers are
+    * written as chunks tagged with the thread number, under g_trace_mutex;
+    * stopping the trace, or the process exiting, writes what every thread
+    * has buffered. Timestamps are nanoseconds since the trace started.
+    * Allocations are stamped when they return and frees when they enter, a
+    * realloc at both ends: replaying in time order never hands out an
+    * address before its previous owner let go of it.
+    * Buffers come from os_map(). A forked child does not write to its
+    * parent's trace.
+*/
+
+typedef struct s_trace_thread {
+    struct s_trace_thread   *next;
+    struct s_trace_thread   *prev;
+    uint8_t                 *buf;            // TRACE_BUFFER_SIZE bytes
+    size_t                  start;           // Bytes already written, g_trace_mutex held
+    size_t                  used;            // Bytes encoded, only the owner stores it
+    uint64_t                last_time;
+    uintptr_t               last_ptr;
+    uint32_t                id;
+    uint32_t                generation;      // Trace the deltas refer to
+    int                     state;           // TRACE_UNINIT / TRACE_ACTIVE / TRACE_DEAD
+} t_trace_thread;
+
+static __thread t_trace_thread g_trace_thread __attribute__((tls_model("initial-exec")));
+
+static pthread_mutex_t  g_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static t_trace_thread   *g_trace_threads;    // Threads with a buffer, under g_trace_mutex
+static int              g_trace_fd = -1;
+static pid_t            g_trace_pid;
+static uint32_t         g_trace_generation;
+static uint32_t         g_trace_next_id;
+static uint64_t         g_trace_base;        // Monotonic nanoseconds at the start
+static pthread_key_t    g_trace_key;
+static pthread_once_t   g_trace_once = PTHREAD_ONCE_INIT;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t trace_clock(void)
+{
+    return monotonic_ns() - g_trace_base;
+}
+
+/* Write the thread's pending events as a chunk, g_trace_mutex held */
+static void write_chunk(t_trace_thread *thread, const uint8_t *data, size_t len)
+{
+    t_trace_chunk chunk = { thread->id, (uint32_t)len };
+    struct iovec iov[2] = {
+        { &chunk, sizeof(chunk) },
+        { (void *)data, len },
+    };
+
+    if (!len || g_trace_fd < 0 || getpid() != g_trace_pid)
+        return;
+    if (writev(g_trace_fd, iov, 2) < 0)
+    {
+        close(g_trace_fd);
+        g_trace_fd = -1;
+        __atomic_store_n(&g_heap.tracing, false, __ATOMIC_RELAXED);
+    }
+}
+
+/* g_trace_mutex held */
+static void flush_thread(t_trace_thread *thread)
+{
+    size_t used = __atomic_load_n(&thread->used, __ATOMIC_ACQUIRE);
+
+    if (thread->generation != g_trace_generation)
+        return;
+    write_chunk(thread, thread->buf + thread->start, used - thread->start);
+    thread->start = used;
+}
+
+static void trace_thread_exit(void *arg)
+{
+    t_trace_thread *thread = (t_trace_thread *)arg;
+
+    pthread_mutex_lock(&g_trace_mutex);
+    flush_thread(thread);
+    if (thread->prev)
+        thread->prev->next = thread->next;
+    else
+        g_trace_threads = thread->next;
+    if (thread->next)
+        thread->next->prev = thread->prev;
+    // Calls made by later TSD destructors are written one by one
+    thread->state = TRACE_DEAD;
+    pthread_mutex_unlock(&g_trace_mutex);
+    os_unmap(thread->buf, TRACE_BUFFER_SIZE);
+    thread->buf = NULL;
+}
+
+static void trace_create_key(void)
+{
+    pthread_key_create(&g_trace_key, trace_thread_exit);
+}
+
+/* The calling thread's trace state, with its buffer unless it is exiting */
+static t_trace_thread *trace_thread(void)
+{
+    t_trace_thread *thread = &g_trace_thread;
+
+    if (thread->state != TRACE_UNINIT)
+        return thread;
+
+    pthread_once(&g_trace_once, trace_create_key);
+    if (!(thread->buf = os_map(TRACE_BUFFER_SIZE)))
+        return NULL;
+    // Active first: pthread_setspecific() may itself call malloc/free
+    thread->state = TRACE_ACTIVE;
+    pthread_mutex_lock(&g_trace_mutex);
+    thread->id = g_trace_next_id++;
+    thread->generation = g_trace_generation;
+    thread->prev = NULL;
+    thread->next = g_trace_threads;
+    if (g_trace_threads)
+        g_trace_threads->prev = thread;
+    g_trace_threads = thread;
+    pthread_mutex_unlock(&g_trace_mutex);
+    if (pthread_setspecific(g_trace_key, thread) != 0)
+        trace_thread_exit(thread);
+    return thread;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Signed distance from the previous pointer, zigzag encoded */
+static uint8_t *put_ptr(uint8_t *p, t_trace_thread *thread, void *ptr)
+{
+    int64_t delta = (int64_t)((uintptr_t)ptr - thread->last_ptr);
+
+    thread->last_ptr = (uintptr_t)ptr;
+    return put_varint(p, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+}
+
+static uint8_t *put_event(uint8_t *p, t_trace_thread *thread, int op, uint64_t time,
+                          void *in, void *out, size_t size, size_t extra)
+{
+    *p++ = (uint8_t)(op | (op != TRACE_FREE && !out ? TRACE_NULL : 0));
+    p = put_varint(p, time - thread->last_time);
+    thread->last_time = time;
+    if (op == TRACE_FREE || op == TRACE_REALLOC)
+        p = put_ptr(p, thread, in);
+    if (op == TRACE_FREE)
+        return p;
+    p = put_varint(p, size);
+    if (op == TRACE_ALIGNED || op == TRACE_REALLOC)
+        p = put_varint(p, extra);   // Alignment, or how long realloc took
+    if (out)
+        p = put_ptr(p, thread, out);
+    return p;
+}
+
+static void record(int op, uint64_t time, void *in, void *out, size_t size, size_t extra)
+{
+    t_trace_thread *thread = trace_thread();
+    uint8_t event[TRACE_EVENT_MAX];
+
+    if (!thread)
+        return;
+    // The trace was restarted: the deltas start over in the new file
+    if (thread->generation != __atomic_load_n(&g_trace_generation, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(&g_trace_mutex);
+        thread->generation = g_trace_generation;
+        thread->start = 0;
+        __atomic_store_n(&thread->used, 0, __ATOMIC_RELEASE);
+        thread->last_time = 0;
+        thread->last_ptr = 0;
+        pthread_mutex_unlock(&g_trace_mutex);
+    }
+    if (thread->state == TRACE_DEAD)
+    {
+        uint8_t *end = put_event(event, thread, op, time, in, out, size, extra);
+
+        pthread_mutex_lock(&g_trace_mutex);
+        write_chunk(thread, event, end - event);
+        pthread_mutex_unlock(&g_trace_mutex);
+        return;
+    }
+    if (thread->used + TRACE_EVENT_MAX > TRACE_BUFFER_SIZE)
+    {
+        pthread_mutex_lock(&g_trace_mutex);
+        flush_thread(thread);
+        thread->start = 0;
+        __atomic_store_n(&thread->used, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&g_trace_mutex);
+    }
+    uint8_t *end = put_event(thread->buf + thread->used, thread, op, time, in, out, size, extra);
+    __atomic_store_n(&thread->used, end - thread->buf, __ATOMIC_RELEASE);
+}
+
+void trace_alloc(int op, void *ptr, size_t size, size_t alignment)
+{
+    record(op, trace_clock(), NULL, ptr, size, alignment);
+}
+
+void trace_realloc(void *old_ptr, void *new_ptr, size_t size, uint64_t start)
+{
+    record(TRACE_REALLOC, start, old_ptr, new_ptr, size, trace_clock() - start);
+}
+
+void trace_free(void *ptr)
+{
+    record(TRACE_FREE, trace_clock(), ptr, NULL, 0, 0);
+}
+
+/* Open the trace file and start recording, heap_init() done */
+static int trace_open(const char *path)
+{
+    t_trace_header header = { TRACE_MAGIC, TRACE_VERSION, 0 };
+    int fd;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    if (write(fd, &header, sizeof(header)) != sizeof(header))
+    {
+        close(fd);
+        return -1;
+    }
+    pthread_mutex_lock(&g_trace_mutex);
+    if (g_trace_fd >= 0)
+    {
+        pthread_mutex_unlock(&g_trace_mutex);
+        close(fd);
+        return -1;
+    }
+    g_trace_fd = fd;
+    g_trace_pid = getpid();
+    g_trace_generation++;
+    g_trace_base = monotonic_ns();
+    __atomic_store_n(&g_heap.tracing, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_trace_mutex);
+    return 0;
+}
+
+/* With MALLOC_TRACE set, record from the first allocation on */
+void trace_init(void)
+{
+    char path[4096];
+
+    if (g_heap.trace_path && pid_path(path, sizeof(path), g_heap.trace_path, ".trace"))
+        trace_open(path);
+}
+
+/* Record every call to path from now on. 0 on success, -1 if it cannot be opened or a trace is running */
+int malloc_trace_start(const char *path)
+{
+    heap_init();
+    if (!path)
+        return -1;
+    return trace_open(path);
+}
+
+/* Write what the threads have buffered and close the trace */
+void malloc_trace_stop(void)
+{
+    pthread_mutex_lock(&g_trace_mutex);
+    __atomic_store_n(&g_heap.tracing, false, __ATOMIC_RELAXED);
+    for (t_trace_thread *thread = g_trace_threads; thread; thread = thread->next)
+        flush_thread(thread);
+    if (g_trace_fd >= 0 && getpid() == g_trace_pid)
+        close(g_trace_fd);
+    g_trace_fd = -1;
+    pthread_mutex_unlock(&g_trace_mutex);
+}
+
+__attribute__((destructor))
+static void trace_at_exit(void)
+{
+    if (g_trace_fd >= 0)
+        malloc_trace_stop();
+}
@@ -2,17 +2,6 @@
 #include <string.h>
 #include <stdint.h>
 
-void *ft_memcpy(void *dest, const void *src, size_t n)
-{
-    char *d = (char *)dest;
-    const char *s = (const char *)src;
-
-    while (n--)
-        *d++ = *s++;
-
-    return dest;
-}
-
 static void putstr(const char *s)
 {
     write(1, s, strlen(s));
@@ -47,76 +36,171 @@ static void write_hex_addr(void *p)
     write(1, buf, 2 + n);
 }
 
+static void lock_arenas(void)
+{
+    for (size_t i = 0; i < g_heap.arena_count; i++)
+        pthread_mutex_lock(&g_heap.arenas[i].mutex);
+}
+
+static void unlock_arenas(void)
+{
+    for (size_t i = g_heap.arena_count; i > 0; i--)
+        pthread_mutex_unlock(&g_heap.arenas[i - 1].mutex);
+}
+
+/* Bytes parked in the LARGE caches, arenas must be locked */
+static size_t large_cached_bytes(void)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < g_heap.arena_count; i++)
+        total += g_heap.arenas[i].large_cached;
+    return total;
+}
+
+/* Print "NAME : <lowest address of that kind>" */
+static void put_section_head(const char *name, int kind)
+{
+    void *first = pagemap_next(kind, NULL);
+
+    putstr(name);
+    putstr(" : ");
+    if (first)
+        write_hex_addr(first);
+    write(1, "\n", 1);
+}
+
+static void tiny_zone_info(t_zone *z, t_zone_info *info)
+{
+    size_t live = 0;
+
+    for (size_t i = 0; i < (z->capacity + 63) / 64; i++)
+        live += __builtin_popcountll(__atomic_load_n(&z->live[i], __ATOMIC_RELAXED));
+    info->slot_size = tiny_class_size(z->size_class);
+    info->used_bytes = live * info->slot_size;
+    info->free_blocks = z->capacity - live;
+    info->free_bytes = info->free_blocks * info->slot_size;
+    info->largest_free = info->free_blocks ? info->slot_size : 0;
+}
+
+static void small_zone_info(t_zone *z, t_zone_info *info)
+{
+    for (t_block *b = z->blocks; b->size; b = NEXT_BLOCK(b))
+    {
+        size_t size = b->size - sizeof(t_block);
+
+        if (!b->is_free && !b->in_tcache)
+        {
+            info->used_bytes += size;
+            continue;
+        }
+        info->free_bytes += size;
+        info->free_blocks++;
+        if (size > info->largest_free)
+            info->largest_free = size;
+    }
+}
+
+/*
+    * Fill up to max entries with the TINY then SMALL zones, in address order.
+    * Returns how many zones there are, which may be more than max.
+*/
+size_t malloc_zone_info(t_zone_info *zones, size_t max)
+{
+    static const int kinds[] = { PAGE_TINY, PAGE_SMALL };
+    size_t count = 0;
+
+    lock_arenas();
+    for (size_t k = 0; k < 2; k++)
+    {
+        for (t_zone *z = pagemap_next(kinds[k], NULL); z; z = pagemap_next(kinds[k], z), count++)
+        {
+            if (count >= max)
+                continue;
+            t_zone_info *info = &zones[count];
+
+            ft_memset(info, 0, sizeof(*info));
+            info->start = z;
+            info->size = z->size;
+            info->kind = kinds[k];
+            if (kinds[k] == PAGE_TINY)
+                tiny_zone_info(z, info);
+            else
+                small_zone_info(z, info);
+        }
+    }
+    unlock_arenas();
+    return count;
+}
+
 void show_alloc_mem(void)
 {
     size_t total = 0;
-    pthread_mutex_lock(&g_heap.mutex);
+    lock_arenas();
 
     // TINY zones
-    putstr("TINY : ");
-    if (g_heap.tiny) write_hex_addr(g_heap.tiny);
-    write(1, "\n", 1);
-    for (t_zone *z = g_heap.tiny; z; z = z->next)
+    put_section_head("TINY", PAGE_TINY);
+    for (t_zone *z = pagemap_next(PAGE_TINY, NULL); z; z = pagemap_next(PAGE_TINY, z))
     {
-        for (t_block *b = z->blocks; b; b = b->next)
+        size_t slot_size = tiny_class_size(z->size_class);
+
+        for (size_t i = 0; i < z->carved; i++)
         {
-            if (!b->is_free)
+            void *start = live_slot(z, i);
+
+            if (start)
             {
-                void *start = (void *)((char *)b + sizeof(t_block));
-                void *end = (void *)((char *)start + b->size);
+                void *end = (void *)((char *)start + slot_size);
                 write_hex_addr(start);
                 putstr(" - ");
                 write_hex_addr(end);
                 putstr(" : ");
-                putnbr_size(b->size); putstr(" bytes\n");
-                total += b->size;
+                putnbr_size(slot_size); putstr(" bytes\n");
+                total += slot_size;
             }
         }
     }
 
     // SMALL zones
-    putstr("SMALL : ");
-    if (g_heap.small) write_hex_addr(g_heap.small);
-    write(1, "\n", 1);
-    for (t_zone *z = g_heap.small; z; z = z->next)
+    put_section_head("SMALL", PAGE_SMALL);
+    for (t_zone *z = pagemap_next(PAGE_SMALL, NULL); z; z = pagemap_next(PAGE_SMALL, z))
     {
-        for (t_block *b = z->blocks; b; b = b->next)
+        for (t_block *b = z->blocks; b->size; b = NEXT_BLOCK(b))
         {
-            if (!b->is_free)
+            if (!b->is_free && !b->in_tcache)
             {
-                void *start = (void *)((char *)b + sizeof(t_block));
-                void *end = (void *)((char *)start + b->size);
+                void *start = BLOCK_DATA(b);
+                size_t size = b->size - sizeof(t_block);
+                void *end = (void *)((char *)start + size);
                 write_hex_addr(start);
                 putstr(" - ");
                 write_hex_addr(end);
                 putstr(" : ");
-                putnbr_size(b->size); putstr(" bytes\n");
-                total += b->size;
+                putnbr_size(size); putstr(" bytes\n");
+                total += size;
             }
         }
     }
 
-    // LARGE list
-    putstr("LARGE : ");
-    if (g_heap.large) write_hex_addr(g_heap.large);
-    write(1, "\n", 1);
-    for (t_block *b = g_heap.large; b; b = b->next)
+    // LARGE mappings
+    put_section_head("LARGE", PAGE_LARGE);
+    for (t_large *l = pagemap_next(PAGE_LARGE, NULL); l; l = pagemap_next(PAGE_LARGE, l))
     {
-        void *start = (void *)((char *)b + sizeof(t_block));
-        void *end = (void *)((char *)start + b->size);
+        void *start = (void *)((char *)l + sizeof(t_large));
+        void *end = (void *)((char *)start + l->size);
         write_hex_addr(start);
         putstr(" - ");
         write_hex_addr(end);
         putstr(" : ");
-        putnbr_size(b->size); putstr(" bytes\n");
-        total += b->size;
+        putnbr_size(l->size); putstr(" bytes\n");
+        total += l->size;
     }
 
     putstr("Total : ");
     putnbr_size(total);
     putstr(" bytes\n");
 
-    pthread_mutex_unlock(&g_heap.mutex);
+    unlock_arenas();
 }
 
 static void print_hex_dump(void *ptr, size_t size)
@@ -196,7 +280,7 @@ static void show_allocation_history(void)
         putstr(" size: ");
         putnbr_size(entry->size);
         putstr(" time: ");
-        putnbr_size((size_t)entry->timestamp);
+        putnbr_size((size_t)heap_wall_time(entry->timestamp));
         putstr("\n");
     }
     
@@ -209,9 +293,33 @@ static void show_allocation_history(void)
     putstr("\n");
 }
 
+/*
+    * Headers no longer carry a timestamp: with MALLOC_STACK_LOGGING the
+    * history has one, print the latest allocation recorded at ptr
+*/
+static void put_alloc_time(void *ptr)
+{
+    size_t i = g_heap.history_count < MAX_ALLOC_HISTORY ? g_heap.history_count : MAX_ALLOC_HISTORY;
+
+    while (g_heap.debug.stack_logging && i-- > 0)
+    {
+        t_alloc_history *entry = &g_heap.history_buffer[i];
+
+        if (entry->ptr == ptr && !entry->is_freed)
+        {
+            putstr(" (allocated at ");
+            putnbr_size((size_t)heap_wall_time(entry->timestamp));
+            putstr(")");
+            break;
+        }
+    }
+    putstr("\n");
+}
+
 void show_alloc_mem_ex(void)
 {
     size_t total = 0;
+    lock_arenas();
     pthread_mutex_lock(&g_heap.mutex);
 
     /* Show debug settings */
@@ -226,8 +334,62 @@ void show_alloc_mem_ex(void)
     putstr(g_heap.debug.stack_logging ? "ON" : "OFF");
     putstr("\nMALLOC_CHECK_: ");
     putnbr_size((size_t)g_heap.debug.check_level);
+    putstr("\nMALLOC_ARENAS: ");
+    putnbr_size(g_heap.arena_count);
+    putstr("\nMALLOC_SPARE_ZONES: ");
+    putnbr_size(g_heap.spare_zones);
+    putstr("\nMALLOC_LARGE_CACHE: ");
+    putnbr_size(g_heap.large_cache_max);
+    putstr("\nMALLOC_LARGE_CACHE_AGE: ");
+    putnbr_size((size_t)g_heap.large_cache_age);
+    putstr("\nMALLOC_HUGEPAGES: ");
+    putstr(g_heap.hugepages ? "ON" : "OFF");
+    putstr("\nMALLOC_RESERVE: ");
+    putnbr_size(g_heap.reserve_size);
     putstr("\n\n");
 
+    /* Show zone recycling counters */
+    putstr("=== Statistics ===\n");
+    putstr("Zones released: ");
+    putnbr_size(__atomic_load_n(&g_heap.stats.zones_released, __ATOMIC_RELAXED));
+    putstr(" (");
+    putnbr_size(__atomic_load_n(&g_heap.stats.bytes_released, __ATOMIC_RELAXED));
+    putstr(" bytes)\n");
+    putstr("LARGE cache: ");
+    putnbr_size(__atomic_load_n(&g_heap.stats.large_hits, __ATOMIC_RELAXED));
+    putstr(" hits, ");
+    putnbr_size(__atomic_load_n(&g_heap.stats.large_misses, __ATOMIC_RELAXED));
+    putstr(" misses (");
+    putnbr_size(large_cached_bytes());
+    putstr(" bytes retained)\n");
+    putstr("Hugepage chunks: ");
+    putnbr_size(__atomic_load_n(&g_heap.stats.chunks, __ATOMIC_RELAXED));
+    putstr(" (");
+    putnbr_size(chunk_thp_bytes());
+    putstr(" bytes THP-backed, ");
+    putnbr_size(__atomic_load_n(&g_heap.stats.chunk_purges, __ATOMIC_RELAXED));
+    putstr(" purges)\n");
+    putstr("Mappings: ");
+    putnbr_size(vm_mappings());
+    putstr(" VMAs, ");
+    putnbr_size(__atomic_load_n(&g_heap.stats.mmap_calls, __ATOMIC_RELAXED));
+    putstr(" mmap calls, ");
+    putnbr_size(__atomic_load_n(&g_heap.stats.munmap_calls, __ATOMIC_RELAXED));
+    putstr(" munmap calls\n");
+    t_malloc_stats stats;
+    malloc_get_stats(&stats);
+    putstr("Allocations: ");
+    putnbr_size(stats.allocs);
+    putstr(" allocs, ");
+    putnbr_size(stats.frees);
+    putstr(" frees, ");
+    putnbr_size(stats.bytes_in_use);
+    putstr(" bytes in use, ");
+    putnbr_size(stats.bytes_mapped);
+    putstr(" bytes mapped, ");
+    putnbr_size(stats.metadata);
+    putstr(" bytes of metadata\n\n");
+
     /* Show allocation history */
     show_allocation_history();
 
@@ -235,10 +397,8 @@ void show_alloc_mem_ex(void)
     putstr("=== Memory Zones ===\n");
     
     // TINY zones
-    putstr("TINY : ");
-    if (g_heap.tiny) write_hex_addr(g_heap.tiny);
-    write(1, "\n", 1);
-    for (t_zone *z = g_heap.tiny; z; z = z->next)
+    put_section_head("TINY", PAGE_TINY);
+    for (t_zone *z = pagemap_next(PAGE_TINY, NULL); z; z = pagemap_next(PAGE_TINY, z))
     {
         putstr("Zone ");
         write_hex_addr(z);
@@ -246,35 +406,35 @@ void show_alloc_mem_ex(void)
         putnbr_size(z->size);
         putstr(" bytes)\n");
         
-        for (t_block *b = z->blocks; b; b = b->next)
+        size_t slot_size = tiny_class_size(z->size_class);
+
+        for (size_t i = 0; i < z->carved; i++)
         {
-            if (!b->is_free)
+            void *start = live_slot(z, i);
+
+            if (start)
             {
-                void *start = (void *)((char *)b + sizeof(t_block));
-                void *end = (void *)((char *)start + b->size);
+                void *end = (void *)((char *)start + slot_size);
                 write_hex_addr(start);
                 putstr(" - ");
                 write_hex_addr(end);
                 putstr(" : ");
-                putnbr_size(b->size);
-                putstr(" bytes (allocated at ");
-                putnbr_size((size_t)b->alloc_time);
-                putstr(")\n");
+                putnbr_size(slot_size);
+                putstr(" bytes");
+                put_alloc_time(start);
                 
                 /* Show hex dump */
-                print_hex_dump(start, b->size);
+                print_hex_dump(start, slot_size);
                 putstr("\n");
                 
-                total += b->size;
+                total += slot_size;
             }
         }
     }
 
     // SMALL zones
-    putstr("SMALL : ");
-    if (g_heap.small) write_hex_addr(g_heap.small);
-    write(1, "\n", 1);
-    for (t_zone *z = g_heap.small; z; z = z->next)
+    put_section_head("SMALL", PAGE_SMALL);
+    for (t_zone *z = pagemap_next(PAGE_SMALL, NULL); z; z = pagemap_next(PAGE_SMALL, z))
     {
         putstr("Zone ");
         write_hex_addr(z);
@@ -282,52 +442,49 @@ void show_alloc_mem_ex(void)
         putnbr_size(z->size);
         putstr(" bytes)\n");
         
-        for (t_block *b = z->blocks; b; b = b->next)
+        for (t_block *b = z->blocks; b->size; b = NEXT_BLOCK(b))
         {
-            if (!b->is_free)
+            if (!b->is_free && !b->in_tcache)
             {
-                void *start = (void *)((char *)b + sizeof(t_block));
-                void *end = (void *)((char *)start + b->size);
+                void *start = BLOCK_DATA(b);
+                size_t size = b->size - sizeof(t_block);
+                void *end = (void *)((char *)start + size);
                 write_hex_addr(start);
                 putstr(" - ");
                 write_hex_addr(end);
                 putstr(" : ");
-                putnbr_size(b->size);
-                putstr(" bytes (allocated at ");
-                putnbr_size((size_t)b->alloc_time);
-                putstr(")\n");
+                putnbr_size(size);
+                putstr(" bytes");
+                put_alloc_time(start);
                 
                 /* Show hex dump */
-                print_hex_dump(start, b->size);
+                print_hex_dump(start, size);
                 putstr("\n");
                 
-                total += b->size;
+                total += size;
             }
         }
     }
 
-    // LARGE list
-    putstr("LARGE : ");
-    if (g_heap.large) write_hex_addr(g_heap.large);
-    write(1, "\n", 1);
-    for (t_block *b = g_heap.large; b; b = b->next)
+    // LARGE mappings
+    put_section_head("LARGE", PAGE_LARGE);
+    for (t_large *l = pagemap_next(PAGE_LARGE, NULL); l; l = pagemap_next(PAGE_LARGE, l))
     {
-        void *start = (void *)((char *)b + sizeof(t_block));
-        void *end = (void *)((char *)start + b->size);
+        void *start = (void *)((char *)l + sizeof(t_large));
+        void *end = (void *)((char *)start + l->size);
         write_hex_addr(start);
         putstr(" - ");
         write_hex_addr(end);
         putstr(" : ");
-        putnbr_size(b->size);
-        putstr(" bytes (allocated at ");
-        putnbr_size((size_t)b->alloc_time);
-        putstr(")\n");
+        putnbr_size(l->size);
+        putstr(" bytes");
+        put_alloc_time(start);
         
         /* Show hex dump */
-        print_hex_dump(start, b->size);
+        print_hex_dump(start, l->size);
         putstr("\n");
         
-        total += b->size;
+        total += l->size;
     }
 
     putstr("Total : ");
@@ -335,4 +492,5 @@ void show_alloc_mem_ex(void)
     putstr(" bytes\n");
 
     pthread_mutex_unlock(&g_heap.mutex);
+    unlock_arenas();
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "../include/malloc.h"
+#include <fcntl.h>
+
+/*
+    * Virtual memory.
+    * heap_init() reserves MALLOC_RESERVE bytes of PROT_NONE address space in
+    * one mapping. Hugepage chunks are committed inside it with mprotect and
+    * decommitted by dropping their pages and protecting them again, so the
+    * zones share a handful of VMAs, cost no mmap/munmap once the range is
+    * set up, and an address belongs to a zone chunk iff it lies in the range.
+    * Slots are handed out lowest address first to keep committed chunks
+    * adjacent. When the range is full or could not be reserved, chunks fall
+    * back to mappings of their own. Without hugepage chunks nothing is reserved.
+*/
+
+void *os_map(size_t size)
+{
+    void *addr;
+
+    __atomic_fetch_add(&g_heap.stats.mmap_calls, 1, __ATOMIC_RELAXED);
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+    __atomic_fetch_add(&g_heap.stats.bytes_mapped, size, __ATOMIC_RELAXED);
+    return addr;
+}
+
+void os_unmap(void *addr, size_t size)
+{
+    __atomic_fetch_add(&g_heap.stats.munmap_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&g_heap.stats.bytes_mapped, size, __ATOMIC_RELAXED);
+    munmap(addr, size);
+}
+
+/* Called once from heap_init(), reserve_size holds the requested size until it succeeds */
+void vm_reserve(void)
+{
+    size_t size = g_heap.reserve_size & ~(CHUNK_SIZE - 1);
+    char *raw;
+    char *base;
+
+    g_heap.reserve_size = 0;
+    if (size > DEFAULT_RESERVE)
+        size = DEFAULT_RESERVE;
+    if (!size || !g_heap.hugepages)
+        return;
+
+    // Over-reserve by a chunk so the range starts on a hugepage boundary.
+    // Nothing is mapped until committed: bypass os_map() and its byte count
+    __atomic_fetch_add(&g_heap.stats.mmap_calls, 1, __ATOMIC_RELAXED);
+    raw = mmap(NULL, size + CHUNK_SIZE, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED)
+        return;
+    base = (char *)(((uintptr_t)raw + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1));
+    __atomic_fetch_add(&g_heap.stats.munmap_calls, base > raw ? 2 : 1, __ATOMIC_RELAXED);
+    if (base > raw)
+        munmap(raw, base - raw);
+    munmap(base + size, raw + CHUNK_SIZE - base);
+
+    // Flag the whole range once, committed slices inherit it and stay mergeable
+    madvise(base, size, MADV_HUGEPAGE);
+    g_heap.reserve = base;
+    g_heap.reserve_size = size;
+}
+
+bool vm_contains(const void *addr)
+{
+    return (uintptr_t)addr - (uintptr_t)g_heap.reserve < g_heap.reserve_size;
+}
+
+/* Commit the lowest free chunk slot of the range, or NULL. Caller holds chunk_mutex */
+void *vm_commit(void)
+{
+    size_t slots = g_heap.reserve_size / CHUNK_SIZE;
+    size_t slot;
+    char *chunk;
+
+    for (size_t i = 0; i * 64 < slots; i++)
+    {
+        if (g_heap.reserve_used[i] == ~0UL)
+            continue;
+        slot = i * 64 + (size_t)__builtin_ctzl(~g_heap.reserve_used[i]);
+        if (slot >= slots)
+            return NULL;
+        chunk = g_heap.reserve + slot * CHUNK_SIZE;
+        if (mprotect(chunk, CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0)
+            return NULL;
+        g_heap.reserve_used[i] |= 1UL << (slot % 64);
+        __atomic_fetch_add(&g_heap.stats.bytes_mapped, CHUNK_SIZE, __ATOMIC_RELAXED);
+        return chunk;
+    }
+    return NULL;
+}
+
+/* Decommit a chunk of the range; false if it was mapped on its own. Caller holds chunk_mutex */
+bool vm_release(void *chunk)
+{
+    size_t slot;
+
+    if (!vm_contains(chunk))
+        return false;
+    slot = ((char *)chunk - g_heap.reserve) / CHUNK_SIZE;
+    madvise(chunk, CHUNK_SIZE, MADV_DONTNEED);
+    mprotect(chunk, CHUNK_SIZE, PROT_NONE);
+    g_heap.reserve_used[slot / 64] &= ~(1UL << (slot % 64));
+    __atomic_fetch_sub(&g_heap.stats.bytes_mapped, CHUNK_SIZE, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* Number of mappings (VMAs) of the process, from /proc/self/maps */
+size_t vm_mappings(void)
+{
+    char buf[4096];
+    size_t count = 0;
+    ssize_t got;
+    int fd;
+
+    fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0)
+        return 0;
+    while ((got = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t i = 0; i < got; i++)
+            count += buf[i] == '\n';
+    }
+    close(fd);
+    return count;
+}
@@ -1,116 +1,282 @@
 #include "../include/malloc.h"
 
-void *allocate_from_zone(t_zone **zone, size_t size, size_t zone_size)
+/* Take a free SMALL block of at least size bytes (header included) from the bins, or from a new zone */
+static t_block *take_block(t_arena *arena, t_zone **zone, size_t size, size_t zone_size)
 {
     t_block *block;
-    t_zone *current_zone;
 
-    // If no zone exists, create the first one
-    if (!*zone)
+    // Jump straight to a bin holding a large enough free block
+    block = bin_take(arena, size);
+    if (!block)
     {
-        *zone = create_zone(zone_size);
-        if (!*zone)
+        // No free block fits: create a new zone and link it to the chain
+        t_zone *new_zone = create_zone(zone_size);
+        if (!new_zone)
             return NULL;
-        
-        // Initialize the first block in the new zone
-        char *zone_start = (char *)*zone + sizeof(t_zone);
-        char *aligned_start = (char *)((((uintptr_t)zone_start) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1));
-        (*zone)->blocks = (t_block *)aligned_start;
-        size_t used_space = aligned_start - (char *)*zone;
-        (*zone)->blocks->size = zone_size - used_space - sizeof(t_block);
-        (*zone)->blocks->is_free = true;
-        (*zone)->blocks->next = NULL;
-        (*zone)->blocks->alloc_time = 0;
-    }
-
-    // Try to find a free block in existing zones
-    current_zone = *zone;
-    while (current_zone)
-    {
-        block = find_free_block(current_zone, size);
-        if (block)
+        if (!pagemap_set(new_zone, zone_size, new_zone, PAGE_SMALL))
         {
-            // Split the block if it's too big
-            if (block->size > size + sizeof(t_block) + ALIGNMENT)
-                split_block(block, size);
-            
-            block->is_free = false;
-            block->alloc_time = time(NULL);
-            return (void *)((char *)block + sizeof(t_block));
+            zone_unmap(new_zone, zone_size);
+            return NULL;
         }
-        current_zone = current_zone->next;
+
+        // One free block spans the zone: its user area starts on an
+        // ALIGNMENT boundary, and a fence header closes the zone
+        t_block *fence = (t_block *)((char *)new_zone + zone_size - sizeof(t_block));
+        new_zone->blocks = (t_block *)((char *)new_zone + ALIGN(sizeof(t_zone)) + sizeof(t_block));
+        new_zone->blocks->size = (uint32_t)((char *)fence - (char *)new_zone->blocks);
+        new_zone->blocks->prev_size = 0;
+        new_zone->blocks->is_free = true;
+        new_zone->blocks->in_tcache = false;
+        fence->size = 0;
+        fence->prev_size = new_zone->blocks->size / ALIGNMENT;
+        fence->is_free = false;
+        fence->in_tcache = false;
+        new_zone->size_class = SMALL_ZONE_CLASS;
+        new_zone->arena = arena->index;
+
+        link_zone(zone, new_zone);
+        arena->empty_zones[SMALL_ZONE_CLASS]++;
+        block = new_zone->blocks;
     }
+    return block;
+}
+
+/* Trim a taken block to size bytes (header included), mark it allocated and account for it in its zone */
+static void *use_block(t_arena *arena, t_block *block, size_t size, size_t *dirty)
+{
+    t_block *tail;
+
+    // Split the block if it's too big, the tail goes back to its bin
+    if ((tail = split_block(block, size)))
+        bin_insert(arena, tail);
 
-    // If no suitable block found, create a new zone
-    t_zone *new_zone = create_zone(zone_size);
-    if (!new_zone)
-        return NULL;
-    
-    // Initialize the first block in the new zone
-    char *zone_start = (char *)new_zone + sizeof(t_zone);
-    char *aligned_start = (char *)((((uintptr_t)zone_start) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1));
-    new_zone->blocks = (t_block *)aligned_start;
-    size_t used_space = aligned_start - (char *)new_zone;
-    new_zone->blocks->size = zone_size - used_space - sizeof(t_block);
-    new_zone->blocks->is_free = true;
-    new_zone->blocks->next = NULL;
-    new_zone->blocks->alloc_time = 0;
-    
-    // Link the new zone to the existing chain
-    new_zone->next = *zone;
-    *zone = new_zone;
-    
-    // Allocate from the new zone
-    block = new_zone->blocks;
-    if (block->size > size + sizeof(t_block) + ALIGNMENT)
-        split_block(block, size);
-    
     block->is_free = false;
-    block->alloc_time = time(NULL);
-    return (void *)((char *)block + sizeof(t_block));
+    block->in_tcache = false;
+
+    t_zone *owner = PAGEMAP_OWNER(pagemap_get(block));
+    if (owner->used++ == 0)
+        arena->empty_zones[SMALL_ZONE_CLASS]--;
+
+    // Past the high-water mark only the bin links were ever written
+    char *end = (char *)block + block->size;
+    *dirty = (char *)block >= owner->clean ? sizeof(t_free_links) : block->size - sizeof(t_block);
+    if (end > owner->clean)
+        owner->clean = end;
+    return BLOCK_DATA(block);
+}
+
+void *allocate_from_zone(t_arena *arena, t_zone **zone, size_t size, size_t zone_size, size_t *dirty)
+{
+    t_block *block = take_block(arena, zone, BLOCK_SIZE(size), zone_size);
+
+    if (!block)
+        return NULL;
+    return use_block(arena, block, BLOCK_SIZE(size), dirty);
 }
 
+/*
+    * Place an aligned block inside a SMALL zone. The free block taken is big
+    * enough to skip up to one alignment step plus a minimal block, so the
+    * leading gap is either empty or split off as a free block of its own.
+*/
+void *allocate_aligned_from_zone(t_arena *arena, size_t size, size_t alignment, size_t *dirty)
+{
+    size_t min_gap = MIN_BLOCK;
+    t_block *block;
+    uintptr_t user;
+    uintptr_t aligned;
+
+    block = take_block(arena, &arena->small, BLOCK_SIZE(size) + alignment + min_gap, SMALL_ZONE_SIZE);
+    if (!block)
+        return NULL;
+
+    user = (uintptr_t)BLOCK_DATA(block);
+    aligned = (user + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != user && aligned - user < min_gap)
+        aligned += alignment;
+    if (aligned != user)
+    {
+        // The gap in front becomes a free block, its neighbours are in use
+        t_block *gap = block;
 
+        block = split_block(gap, aligned - user);
+        gap->is_free = true;
+        bin_insert(arena, gap);
+    }
+    return use_block(arena, block, BLOCK_SIZE(size), dirty);
+}
 
 t_zone *create_zone(size_t zone_size)
 {
     t_zone *new_zone;
+    bool zeroed;
 
-    new_zone = mmap(NULL, zone_size, PROT_READ | PROT_WRITE,
-                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (new_zone == MAP_FAILED)
+    new_zone = zone_map(zone_size, &zeroed);
+    if (!new_zone)
         return NULL;
 
     new_zone->size = zone_size;
     new_zone->next = NULL;
+    new_zone->prev = NULL;
     new_zone->blocks = NULL;
+    new_zone->used = 0;
+    // Recycled chunk units may hold old data
+    new_zone->clean = (char *)new_zone + (zeroed ? 0 : zone_size);
+    new_zone->sampled = 0;
+    __atomic_fetch_add(&g_heap.stats.zones_created, 1, __ATOMIC_RELAXED);
 
     return new_zone;
 }
 
-void *allocate_large(size_t size)
+void link_zone(t_zone **list, t_zone *zone)
 {
-    t_block *new_block;
-    size_t total_size;
-
-    // Calculate total size needed (block header + aligned size)
-    total_size = sizeof(t_block) + size;
-    
-    // Allocate memory using mmap
-    new_block = mmap(NULL, total_size, PROT_READ | PROT_WRITE,
-                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (new_block == MAP_FAILED)
+    zone->prev = NULL;
+    zone->next = *list;
+    if (*list)
+        (*list)->prev = zone;
+    *list = zone;
+}
+
+/*
+    * Called when the last block of a zone is freed. Up to g_heap.spare_zones
+    * empty zones are kept per class to absorb the next burst without an
+    * mmap/munmap round trip. Returns true when the caller should unmap it,
+    * expired LARGE mappings are given back along with it.
+*/
+bool zone_emptied(t_arena *arena, size_t zone_class)
+{
+    if (arena->empty_zones[zone_class] < g_heap.spare_zones)
+    {
+        arena->empty_zones[zone_class]++;
+        return false;
+    }
+    large_cache_trim(arena);
+    return true;
+}
+
+/* Unlink an empty zone from its arena list and give it back to its chunk or the OS */
+void unmap_zone(t_zone **list, t_zone *zone)
+{
+    size_t size = zone->size;
+
+    if (zone->prev)
+        zone->prev->next = zone->next;
+    else
+        *list = zone->next;
+    if (zone->next)
+        zone->next->prev = zone->prev;
+
+    pagemap_clear(zone, size);
+    zone_unmap(zone, size);
+    __atomic_fetch_add(&g_heap.stats.zones_released, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_heap.stats.bytes_released, size, __ATOMIC_RELAXED);
+}
+
+/*
+    * Map size bytes aligned on alignment (a power of two, multiple of the page
+    * size). Over-map by alignment and trim both ends.
+*/
+void *map_aligned(size_t size, size_t alignment)
+{
+    char *raw;
+    char *aligned;
+    size_t head;
+    size_t tail;
+
+    raw = os_map(size + alignment);
+    if (!raw)
+        return NULL;
+
+    aligned = (char *)(((uintptr_t)raw + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    head = aligned - raw;
+    tail = alignment - head;
+    if (head)
+        os_unmap(raw, head);
+    if (tail)
+        os_unmap(aligned + size, tail);
+    return aligned;
+}
+
+/*
+    * Map a LARGE region of len bytes whose first page is followed by an
+    * alignment boundary (alignment above the page size): the header sits at
+    * the end of that first page and the user area starts on the boundary.
+*/
+static char *map_large_aligned(size_t len, size_t alignment)
+{
+    size_t page = PAGE_SIZE;
+    char *raw;
+    char *base;
+
+    raw = os_map(len + alignment);
+    if (!raw)
         return NULL;
 
+    base = (char *)((((uintptr_t)raw + page + alignment - 1) & ~(uintptr_t)(alignment - 1)) - page);
+    if (base > raw)
+        os_unmap(raw, base - raw);
+    if (raw + len + alignment > base + len)
+        os_unmap(base + len, raw + len + alignment - (base + len));
+    return base;
+}
+
+/*
+    * A LARGE mapping starts on a page boundary and its header is placed in the
+    * first page, right before the user area, so the mapping always starts at
+    * the header's page. Only the user area's page is registered in the page map.
+*/
+void *allocate_large(t_arena *arena, size_t size, size_t alignment, size_t *dirty)
+{
+    size_t page = PAGE_SIZE;
+    t_large *large;
+    char *base;
+    size_t offset;
+    size_t pages;
+
+    // Offset of the user area in the mapping, then total size in whole pages
+    if (alignment > page)
+        offset = page;
+    else
+        offset = (sizeof(t_large) + alignment - 1) & ~(alignment - 1);
+    pages = (offset + size + page - 1) / page;
+
+    // Reuse a recently freed mapping, or allocate memory using mmap
+    base = alignment > page ? NULL : (char *)large_cache_take(arena, pages);
+    if (base)
+    {
+        pages = ((t_large *)base)->pages;
+        *dirty = size;
+    }
+    else
+    {
+        // A miss maps anyway: give back what expired meanwhile
+        large_cache_trim(arena);
+        if (alignment > page)
+            base = map_large_aligned(pages * page, alignment);
+        else
+            base = os_map(pages * page);
+        if (!base)
+            return NULL;
+        *dirty = 0;
+        __atomic_fetch_add(&g_heap.stats.large_mmaps, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_heap.stats.large_mapped, pages * page, __ATOMIC_RELAXED);
+    }
+
     // Initialize the block
-    new_block->size = size;
-    new_block->is_free = false;
-    new_block->next = g_heap.large;
-    new_block->alloc_time = time(NULL);
-    
-    // Add to the large blocks list
-    g_heap.large = new_block;
+    large = (t_large *)(base + offset - sizeof(t_large));
+    large->size = size;
+    large->arena = arena->index;
+    large->pages = (uint32_t)pages;
+    large->sampled = false;
+    large->next = NULL;
+
+    // Register the user page so free() and realloc() can recognize it
+    if (!pagemap_set(base + offset, ALIGNMENT, large, PAGE_LARGE))
+    {
+        large_cache_unmap(large);
+        return NULL;
+    }
 
     // Return pointer to usable memory (after the block header)
-    return (void *)((char *)new_block + sizeof(t_block));
+    return (void *)(base + offset);
 }
@@ -0,0 +1,97 @@
+#!/bin/bash
+
+# Benchmark multi-thread: malloc custom vs système sur des charges classiques
+# Usage: ./test/bench.sh [workload...]
+# BENCH_MAX_THREADS fixe le nombre maximal de threads (défaut: nproc)
+# BENCH_LIB désigne la bibliothèque à précharger (défaut: celle du Makefile)
+
+set -e
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+LIB="${BENCH_LIB:-./libft_malloc_${HOSTTYPE:-$(uname -m)_$(uname -s)}.so}"
+BIN="./bench_workloads"
+results_file="bench_results.csv"
+max_threads="${BENCH_MAX_THREADS:-$(nproc)}"
+
+if [ $# -gt 0 ]; then
+    workloads="$*"
+else
+    workloads="larson xmalloc cache-scratch cache-thrash threadtest mstress"
+fi
+
+if [ ! -f "$LIB" ]; then
+    echo -e "${RED}Library $LIB not found, build it with: make${NC}" >&2
+    exit 1
+fi
+
+echo -e "${BLUE}=== Allocator Benchmark ===${NC}"
+echo "Threads: 1..$max_threads"
+
+gcc -O2 -pthread -o "$BIN" test/bench_workloads.c
+trap 'rm -f "$BIN"' EXIT
+
+# 1, 2, 4, ... puis max_threads
+thread_counts=""
+for ((t = 1; t < max_threads; t *= 2)); do
+    thread_counts="$thread_counts $t"
+done
+thread_counts="$thread_counts $max_threads"
+
+echo "workload,allocator,threads,ops_per_sec,scaling_efficiency,peak_rss_kb" > "$results_file"
+
+# Lance une charge et affiche "ops/s rss_kb"
+run_workload() {
+    local allocator="$1"
+    local workload="$2"
+    local threads="$3"
+    local output
+
+    if [ "$allocator" = "custom" ]; then
+        output=$(LD_PRELOAD="$LIB" "$BIN" "$workload" "$threads")
+    else
+        output=$("$BIN" "$workload" "$threads")
+    fi
+    echo "$output" | awk '{ printf "%.0f %d\n", $1 / $2, $3 }'
+}
+
+for workload in $workloads; do
+    echo -e "${BLUE}Running $workload...${NC}"
+    for allocator in system custom; do
+        base=""
+        for threads in $thread_counts; do
+            read -r ops rss <<< "$(run_workload "$allocator" "$workload" "$threads")"
+            [ -z "$base" ] && base="$ops"
+            # Efficacité = débit(N) / (N * débit(1)), 1.00 si parfaitement linéaire
+            efficiency=$(awk -v ops="$ops" -v base="$base" -v n="$threads" \
+                'BEGIN { printf "%.2f", ops / (n * base) }')
+            echo "$workload,$allocator,$threads,$ops,$efficiency,$rss" >> "$results_file"
+            printf "  %-7s %3d threads: %12s ops/s  eff %s  rss %s KiB\n" \
+                "$allocator" "$threads" "$ops" "$efficiency" "$rss"
+        done
+    done
+done
+
+# Résumé: débit custom / système au nombre de threads maximal
+echo -e "${BLUE}=== Summary at $max_threads threads ===${NC}"
+awk -F, -v n="$max_threads" '
+    NR > 1 && $3 == n { ops[$1 "," $2] = $4; if (!($1 in seen)) { seen[$1] = 1; order[++count] = $1 } }
+    END {
+        for (i = 1; i <= count; i++) {
+            w = order[i]
+            printf "%-14s custom/system = %.2fx\n", w, ops[w ",custom"] / ops[w ",system"]
+        }
+    }' "$results_file" | while read -r line; do
+    ratio=$(echo "$line" | sed 's/.*= \([0-9.]*\)x/\1/')
+    if awk -v r="$ratio" 'BEGIN { exit !(r >= 1) }'; then
+        echo -e "${GREEN}$line${NC}"
+    else
+        echo -e "${YELLOW}$line${NC}"
+    fi
+done
+
+echo -e "${GREEN}Results saved to $results_file${NC}"
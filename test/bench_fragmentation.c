@@ -0,0 +1,220 @@
+/*
+    * Long-running key-value churn, for steady-state fragmentation.
+    * Usage: bench_fragmentation <label> [ops] [keys] [maxmemory MiB] [reports]
+    * A cache of <keys> slots takes a Redis-like mix: sets of new keys,
+    * updates that resize a value in place (realloc), deletes, and evictions
+    * of random keys whenever the values exceed maxmemory. The value sizes
+    * drift over the run, so blocks freed for one size must serve others.
+    * <reports> times along the run, one CSV row on stdout gives the window's
+    * throughput, the bytes the program holds, the RSS, what the allocator has
+    * mapped (mallinfo2) and their ratios. With libft_malloc preloaded, the
+    * row also sums up its TINY/SMALL zones (malloc_zone_info): free bytes,
+    * and the largest free block of the zones, largest and median.
+    * Run it as is for the system allocator, with LD_PRELOAD for libft_malloc
+    * (test/bench_fragmentation.sh).
+*/
+#include "../include/malloc.h"
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ZONES       65536
+#define SIZE_EPOCHS     8           // The size mix changes this many times
+
+typedef size_t (*t_zone_info_fn)(t_zone_info *, size_t);
+
+static t_zone_info      g_zones[MAX_ZONES];
+static size_t           g_largest[MAX_ZONES];
+static uint64_t         g_rng = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_random(void)
+{
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return g_rng;
+}
+
+/*
+    * Value sizes: mostly short strings, some serialized objects, a few big
+    * blobs. Each epoch scales the medium sizes differently.
+*/
+static size_t value_size(unsigned epoch)
+{
+    static const unsigned scale[SIZE_EPOCHS] = { 4, 7, 2, 9, 5, 3, 8, 6 };
+    uint64_t r = next_random();
+
+    if (r % 1000 < 5)
+        return 4096 + r % (64 * 1024);
+    if (r % 100 < 30)
+        return 128 + r % (scale[epoch % SIZE_EPOCHS] * 256);
+    return 16 + r % 112;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long rss_kb(void)
+{
+    char buf[128];
+    int fd = open("/proc/self/statm", O_RDONLY);
+    ssize_t n;
+    long size = 0;
+    long resident = 0;
+
+    if (fd < 0)
+        return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+    sscanf(buf, "%ld %ld", &size, &resident);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int compare_size(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void report(const char *label, t_zone_info_fn zone_info, size_t ops, double rate, size_t live)
+{
+    struct mallinfo2 info = mallinfo2();
+    size_t mapped = info.arena + info.hblkhd;
+    long rss = rss_kb();
+    size_t zones = 0;
+    size_t zone_free = 0;
+    size_t largest = 0;
+    size_t median = 0;
+
+    if (zone_info)
+    {
+        zones = zone_info(g_zones, MAX_ZONES);
+        if (zones > MAX_ZONES)
+            zones = MAX_ZONES;
+        for (size_t i = 0; i < zones; i++)
+        {
+            zone_free += g_zones[i].free_bytes;
+            g_largest[i] = g_zones[i].largest_free;
+        }
+        qsort(g_largest, zones, sizeof(size_t), compare_size);
+        if (zones)
+        {
+            largest = g_largest[zones - 1];
+            median = g_largest[zones / 2];
+        }
+    }
+    printf("%s,%zu,%.0f,%zu,%ld,%zu,%.3f,%.3f,%zu,%zu,%zu,%zu\n", label, ops, rate, live / 1024,
+           rss, mapped / 1024, live ? (double)mapped / live : 0, live ? rss * 1024.0 / live : 0,
+           zones, zone_free / 1024, largest, median);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    size_t ops = 5000000;
+    size_t keys = 200000;
+    size_t maxmemory = 64;
+    size_t reports = 20;
+    size_t live = 0;
+    char **values;
+    size_t *sizes;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <label> [ops] [keys] [maxmemory MiB] [reports]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        ops = (size_t)atol(argv[2]);
+    if (argc > 3)
+        keys = (size_t)atol(argv[3]);
+    if (argc > 4)
+        maxmemory = (size_t)atol(argv[4]);
+    if (argc > 5 && atol(argv[5]) > 0)
+        reports = (size_t)atol(argv[5]);
+    maxmemory *= 1024 * 1024;
+    values = calloc(keys, sizeof(char *));
+    sizes = calloc(keys, sizeof(size_t));
+
+    // Present only when libft_malloc is preloaded
+    t_zone_info_fn zone_info = (t_zone_info_fn)dlsym(RTLD_DEFAULT, "malloc_zone_info");
+    size_t window = ops / reports ? ops / reports : 1;
+    double window_start = now();
+    double start = window_start;
+
+    for (size_t op = 1; op <= ops; op++)
+    {
+        size_t k = next_random() % keys;
+        uint64_t r = next_random() % 100;
+        unsigned epoch = (unsigned)(op * SIZE_EPOCHS / (ops + 1));
+
+        if (values[k] && r < 20)
+        {
+            // Delete
+            free(values[k]);
+            values[k] = NULL;
+            live -= sizes[k];
+        }
+        else if (values[k] && r < 60)
+        {
+            // Update: the new value reuses the old buffer when it can
+            size_t size = value_size(epoch);
+            char *ptr = realloc(values[k], size);
+
+            live += size - sizes[k];
+            ptr[0] = ptr[size - 1] = (char)op;
+            values[k] = ptr;
+            sizes[k] = size;
+        }
+        else if (!values[k])
+        {
+            size_t size = value_size(epoch);
+
+            values[k] = malloc(size);
+            memset(values[k], (int)op, size < 64 ? size : 64);
+            values[k][size - 1] = (char)op;
+            sizes[k] = size;
+            live += size;
+        }
+        // Evict random keys down to maxmemory
+        while (live > maxmemory)
+        {
+            size_t victim = next_random() % keys;
+
+            if (values[victim])
+            {
+                free(values[victim]);
+                values[victim] = NULL;
+                live -= sizes[victim];
+            }
+        }
+        if (op % window == 0)
+        {
+            double t = now();
+
+            report(argv[1], zone_info, op, window / (t - window_start), live);
+            window_start = t;
+        }
+    }
+    fprintf(stderr, "%s: %zu ops in %.2f s\n", argv[1], ops, now() - start);
+    for (size_t k = 0; k < keys; k++)
+        free(values[k]);
+    free(values);
+    free(sizes);
+    return 0;
+}
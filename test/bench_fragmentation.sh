@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Fragmentation en régime permanent: churn clé-valeur, malloc custom vs glibc
+# Usage: ./test/bench_fragmentation.sh [ops] [clés] [maxmemory MiB] [rapports]
+# BENCH_LIB désigne la bibliothèque à précharger (défaut: celle du Makefile)
+
+set -e
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+LIB="${BENCH_LIB:-./libft_malloc_${HOSTTYPE:-$(uname -m)_$(uname -s)}.so}"
+BIN="./bench_fragmentation"
+results_file="fragmentation_results.csv"
+ops="${1:-5000000}"
+keys="${2:-200000}"
+maxmemory="${3:-64}"
+reports="${4:-20}"
+
+if [ ! -f "$LIB" ]; then
+    echo -e "${RED}Library $LIB not found, build it with: make${NC}" >&2
+    exit 1
+fi
+
+echo -e "${BLUE}=== Key-Value Fragmentation Benchmark ===${NC}"
+echo "Ops: $ops, keys: $keys, maxmemory: ${maxmemory} MiB, $reports reports"
+
+gcc -O2 -I include -o "$BIN" test/bench_fragmentation.c
+trap 'rm -f "$BIN"' EXIT
+
+echo "allocator,ops,ops_per_sec,live_kb,rss_kb,mapped_kb,mapped_per_used,rss_per_used,zones,zone_free_kb,largest_free_max,largest_free_median" > "$results_file"
+"$BIN" glibc "$ops" "$keys" "$maxmemory" "$reports" >> "$results_file"
+LD_PRELOAD="$LIB" "$BIN" libft "$ops" "$keys" "$maxmemory" "$reports" >> "$results_file"
+
+# Premier rapport contre dernier: la dérive montre la dégradation du tas
+echo -e "\n${BLUE}=== Steady state ===${NC}"
+printf "%-6s %12s %18s %18s %14s\n" "alloc" "ops/s" "mapped/used" "rss/used" "zone free KiB"
+awk -F, '
+    NR > 1 {
+        a = $1
+        if (!(a in first)) { first[a] = $7; first_rss[a] = $8; order[++count] = a }
+        last[a] = $7; last_rss[a] = $8; free_kb[a] = $10
+        rate[a] += $3; reports[a]++
+    }
+    END {
+        for (i = 1; i <= count; i++) {
+            a = order[i]
+            printf "%-6s %12.0f %8.3f -> %6.3f %8.3f -> %6.3f %14d\n", a, rate[a] / reports[a],
+                first[a], last[a], first_rss[a], last_rss[a], free_kb[a]
+        }
+    }' "$results_file"
+
+echo -e "${GREEN}Results saved to $results_file${NC}"
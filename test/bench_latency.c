@@ -0,0 +1,295 @@
+/*
+    * Per-call latency of malloc, realloc and free, by size class.
+    * Usage: bench_latency <label> <hgrm dir> [samples per case]
+    * Every call is timed on its own with the time stamp counter and recorded
+    * in a log-linear histogram (HdrHistogram layout, 16 sub-buckets per power
+    * of two, about 6% precision). Prints a percentile table in nanoseconds on
+    * stderr, one CSV row per case and operation on stdout (values in cycles),
+    * and writes each histogram as <dir>/<label>_<case>_<op>.hgrm in the
+    * HdrHistogram percentile format. Run it as is for the system allocator,
+    * with LD_PRELOAD for libft_malloc (test/bench_latency.sh).
+*/
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __x86_64__
+# include <x86intrin.h>
+#endif
+
+#define SUB_BITS        4
+#define SUB_COUNT       (1 << SUB_BITS)
+#define HIST_BUCKETS    (64 * SUB_COUNT)
+#define DEFAULT_SAMPLES 100000
+#define MAX_BATCH       1000
+#define BATCH_BYTES     (64 * 1024 * 1024)  // Live memory per batch
+
+enum { OP_MALLOC, OP_REALLOC, OP_FREE, OP_COUNT };
+
+static const char *g_op_names[OP_COUNT] = { "malloc", "realloc", "free" };
+
+typedef struct s_case {
+    const char      *name;
+    size_t          size;
+} t_case;
+
+// Class boundaries of libft_malloc: TINY up to 512, SMALL up to 4096
+static const t_case g_cases[] = {
+    { "tiny-16",    16 },
+    { "tiny-128",   128 },
+    { "tiny-512",   512 },
+    { "small-513",  513 },
+    { "small-2048", 2048 },
+    { "small-4096", 4096 },
+    { "large-4097", 4097 },
+    { "large-64k",  64 * 1024 },
+    { "large-1m",   1024 * 1024 },
+};
+
+#define CASE_COUNT (sizeof(g_cases) / sizeof(g_cases[0]))
+
+typedef struct s_hist {
+    uint64_t        counts[HIST_BUCKETS];
+    uint64_t        total;
+    uint64_t        min;
+    uint64_t        max;
+    double          sum;
+    double          sum_squares;
+} t_hist;
+
+static t_hist   g_hists[OP_COUNT];
+static void     *g_ptrs[MAX_BATCH];
+static size_t   g_order[MAX_BATCH];
+static double   g_cycles_per_ns = 1.0;
+
+static inline uint64_t stamp(void)
+{
+#ifdef __x86_64__
+    // lfence keeps the call from being reordered around the read
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static double wall_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void calibrate(void)
+{
+#ifdef __x86_64__
+    double start = wall_ns();
+    uint64_t t0 = stamp();
+
+    while (wall_ns() - start < 100e6)
+        ;
+    g_cycles_per_ns = (stamp() - t0) / (wall_ns() - start);
+#endif
+}
+
+/* Bucket of a value: exact below 2 * SUB_COUNT, then SUB_COUNT per power of two */
+static size_t bucket_of(uint64_t v)
+{
+    if (v < 2 * SUB_COUNT)
+        return (size_t)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+
+    return (size_t)shift * SUB_COUNT + (size_t)(v >> shift);
+}
+
+/* Highest value that lands in a bucket */
+static uint64_t bucket_top(size_t i)
+{
+    if (i < 2 * SUB_COUNT)
+        return i;
+    size_t shift = i / SUB_COUNT - 1;
+    uint64_t sub = i % SUB_COUNT + SUB_COUNT;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+static void record(t_hist *h, uint64_t v)
+{
+    h->counts[bucket_of(v)]++;
+    if (!h->total || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->total++;
+    h->sum += (double)v;
+    h->sum_squares += (double)v * v;
+}
+
+static uint64_t percentile(const t_hist *h, double p)
+{
+    uint64_t rank = (uint64_t)(p / 100.0 * h->total + 0.5);
+    uint64_t seen = 0;
+
+    if (rank < 1)
+        rank = 1;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return bucket_top(i) < h->max ? bucket_top(i) : h->max;
+    }
+    return h->max;
+}
+
+static void write_hgrm(const t_hist *h, const char *dir, const char *label, const char *name, const char *op)
+{
+    char path[4096];
+    uint64_t seen = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s_%s_%s.hgrm", dir, label, name, op);
+    if (!(f = fopen(path, "w")))
+    {
+        perror(path);
+        return;
+    }
+    fprintf(f, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        if (!h->counts[i])
+            continue;
+        seen += h->counts[i];
+        double q = (double)seen / h->total;
+        double ns = (bucket_top(i) < h->max ? bucket_top(i) : h->max) / g_cycles_per_ns;
+
+        if (q < 1.0)
+            fprintf(f, "%12.3f %2.12f %10lu %14.2f\n", ns, q, seen, 1.0 / (1.0 - q));
+        else
+            fprintf(f, "%12.3f %2.12f %10lu\n", ns, q, seen);
+    }
+    double mean = h->sum / h->total;
+    double variance = h->sum_squares / h->total - mean * mean;
+
+    fprintf(f, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+            mean / g_cycles_per_ns, sqrt(variance > 0 ? variance : 0) / g_cycles_per_ns);
+    fprintf(f, "#[Max     = %12.3f, Total count    = %12lu]\n", h->max / g_cycles_per_ns, h->total);
+    fprintf(f, "#[Buckets = %12d, SubBuckets     = %12d]\n", HIST_BUCKETS / SUB_COUNT, SUB_COUNT);
+    fclose(f);
+}
+
+static void shuffle(size_t n, uint64_t *rng)
+{
+    for (size_t i = 0; i < n; i++)
+        g_order[i] = i;
+    for (size_t i = n - 1; i > 0; i--)
+    {
+        *rng ^= *rng << 13;
+        *rng ^= *rng >> 7;
+        *rng ^= *rng << 17;
+        size_t j = *rng % (i + 1);
+        size_t t = g_order[i];
+
+        g_order[i] = g_order[j];
+        g_order[j] = t;
+    }
+}
+
+static void run_case(const t_case *c, size_t samples)
+{
+    size_t batch = BATCH_BYTES / (2 * c->size);
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+    if (batch > MAX_BATCH)
+        batch = MAX_BATCH;
+    memset(g_hists, 0, sizeof(g_hists));
+    for (size_t done = 0; done < samples; done += batch)
+    {
+        // malloc then free in random order: the free lists get mixed up
+        shuffle(batch, &rng);
+        for (size_t i = 0; i < batch; i++)
+        {
+            uint64_t t0 = stamp();
+            g_ptrs[i] = malloc(c->size);
+            record(&g_hists[OP_MALLOC], stamp() - t0);
+            ((volatile char *)g_ptrs[i])[0] = 1;
+        }
+        for (size_t i = 0; i < batch; i++)
+        {
+            void *ptr = g_ptrs[g_order[i]];
+            uint64_t t0 = stamp();
+            free(ptr);
+            record(&g_hists[OP_FREE], stamp() - t0);
+        }
+
+        // realloc to twice the size, which crosses the class boundaries
+        for (size_t i = 0; i < batch; i++)
+        {
+            g_ptrs[i] = malloc(c->size);
+            ((volatile char *)g_ptrs[i])[0] = 1;
+        }
+        for (size_t i = 0; i < batch; i++)
+        {
+            void *ptr = g_ptrs[g_order[i]];
+            uint64_t t0 = stamp();
+            ptr = realloc(ptr, 2 * c->size);
+            record(&g_hists[OP_REALLOC], stamp() - t0);
+            g_ptrs[g_order[i]] = ptr;
+        }
+        for (size_t i = 0; i < batch; i++)
+            free(g_ptrs[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const double points[] = { 50, 90, 99, 99.9, 99.99 };
+    size_t samples = DEFAULT_SAMPLES;
+    const char *label;
+    const char *dir;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <label> <hgrm dir> [samples per case]\n", argv[0]);
+        return 1;
+    }
+    label = argv[1];
+    dir = argv[2];
+    if (argc > 3 && atol(argv[3]) > 0)
+        samples = (size_t)atol(argv[3]);
+    calibrate();
+
+    fprintf(stderr, "%s: %.2f cycles/ns, %zu samples per case, latencies in ns\n",
+            label, g_cycles_per_ns, samples);
+    fprintf(stderr, "%-11s %-8s %8s %8s %8s %8s %9s %9s %10s\n",
+            "case", "op", "min", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    for (size_t c = 0; c < CASE_COUNT; c++)
+    {
+        run_case(&g_cases[c], samples);
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            const t_hist *h = &g_hists[op];
+            uint64_t p[5];
+
+            for (int i = 0; i < 5; i++)
+                p[i] = percentile(h, points[i]);
+            fprintf(stderr, "%-11s %-8s %8.0f %8.0f %8.0f %8.0f %9.0f %9.0f %10.0f\n",
+                    g_cases[c].name, g_op_names[op], h->min / g_cycles_per_ns,
+                    p[0] / g_cycles_per_ns, p[1] / g_cycles_per_ns, p[2] / g_cycles_per_ns,
+                    p[3] / g_cycles_per_ns, p[4] / g_cycles_per_ns, h->max / g_cycles_per_ns);
+            printf("%s,%s,%zu,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.3f\n",
+                   label, g_cases[c].name, g_cases[c].size, g_op_names[op], h->total,
+                   h->min, p[0], p[1], p[2], p[3], p[4], h->max, g_cycles_per_ns);
+            write_hgrm(h, dir, label, g_cases[c].name, g_op_names[op]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Latence par appel de malloc/realloc/free: malloc custom vs glibc
+# Usage: ./test/bench_latency.sh [échantillons par cas]
+# BENCH_LIB désigne la bibliothèque à précharger (défaut: celle du Makefile)
+
+set -e
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+LIB="${BENCH_LIB:-./libft_malloc_${HOSTTYPE:-$(uname -m)_$(uname -s)}.so}"
+BIN="./bench_latency"
+results_file="latency_results.csv"
+hgrm_dir="latency_hgrm"
+samples="${1:-100000}"
+
+if [ ! -f "$LIB" ]; then
+    echo -e "${RED}Library $LIB not found, build it with: make${NC}" >&2
+    exit 1
+fi
+
+echo -e "${BLUE}=== Allocation Latency Benchmark ===${NC}"
+
+gcc -O2 -o "$BIN" test/bench_latency.c -lm
+trap 'rm -f "$BIN"' EXIT
+mkdir -p "$hgrm_dir"
+
+echo "allocator,case,size,op,count,min,p50,p90,p99,p999,p9999,max,cycles_per_ns" > "$results_file"
+"$BIN" glibc "$hgrm_dir" "$samples" >> "$results_file"
+echo
+LD_PRELOAD="$LIB" "$BIN" libft "$hgrm_dir" "$samples" >> "$results_file"
+
+# Compare les queues de distribution: ratio custom/glibc à p99 et p99.9
+echo -e "\n${BLUE}=== libft / glibc ===${NC}"
+printf "%-11s %-8s %8s %8s\n" "case" "op" "p99" "p99.9"
+awk -F, '
+    NR > 1 && $1 == "glibc" { p99[$2 "," $4] = $9; p999[$2 "," $4] = $10 }
+    NR > 1 && $1 == "libft" {
+        k = $2 "," $4
+        printf "%-11s %-8s %7.2fx %7.2fx\n", $2, $4, $9 / p99[k], $10 / p999[k]
+    }' "$results_file" | while read -r line; do
+    if echo "$line" | awk '{ exit !($3 + 0 <= 1 && $4 + 0 <= 1) }'; then
+        echo -e "${GREEN}$line${NC}"
+    else
+        echo -e "${YELLOW}$line${NC}"
+    fi
+done
+
+echo -e "${GREEN}Results saved to $results_file, histograms in $hgrm_dir/${NC}"
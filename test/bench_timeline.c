@@ -0,0 +1,261 @@
+/*
+    * Memory timeline of an allocator through a phased workload.
+    * Usage: bench_timeline <label> [live MiB] [rest ms] [interval ms]
+    * A sampler thread reads the RSS and anonymous memory (smaps_rollup), the
+    * mapped size (statm), the VMA count (maps) and the page faults
+    * (getrusage) every interval while the main thread runs:
+    *   ramp    grow the live set to <live MiB> of mixed sizes
+    *   churn   replace random blocks, the live set stays the same
+    *   spike   allocate three times the live set on top, then free it
+    *   drain   free everything, in random order
+    *   rest    allocate nothing: what the allocator gives back over time
+    * One CSV row per sample on stdout, a summary on stderr. Run it as is for
+    * the system allocator, with LD_PRELOAD for libft_malloc
+    * (test/bench_timeline.sh).
+*/
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_BLOCKS      (4 * 1024 * 1024)
+#define CHURN_ROUNDS    4           // Churn replaces the live set this many times
+#define SPIKE_FACTOR    3
+
+enum { PHASE_RAMP, PHASE_CHURN, PHASE_SPIKE, PHASE_DRAIN, PHASE_REST, PHASE_DONE };
+
+static const char *g_phase_names[] = { "ramp", "churn", "spike", "drain", "rest" };
+
+typedef struct s_sample {
+    long            rss_kb;
+    long            anon_kb;
+    long            mapped_kb;
+    long            vmas;
+    long            minflt;
+    long            majflt;
+} t_sample;
+
+static int              g_phase;
+static size_t           g_live_bytes;
+static long             g_interval_ms = 10;
+static const char       *g_label;
+static double           g_start;
+static t_sample         g_phase_end[PHASE_DONE];
+static long             g_peak_rss;
+static void             **g_blocks;
+static size_t           *g_sizes;
+static uint64_t         g_rng = 0x9E3779B97F4A7C15ULL;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static uint64_t next_random(void)
+{
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return g_rng;
+}
+
+/* Mostly TINY, a quarter SMALL, a few LARGE */
+static size_t random_size(void)
+{
+    uint64_t r = next_random();
+
+    if (r % 100 < 2)
+        return 4096 + r % (256 * 1024);
+    if (r % 100 < 25)
+        return 512 + r % 3584;
+    return 16 + r % 496;
+}
+
+/* Read a whole /proc file into buf, without going through stdio */
+static ssize_t read_proc(const char *path, char *buf, size_t cap)
+{
+    int fd = open(path, O_RDONLY);
+    ssize_t total = 0;
+    ssize_t n;
+
+    if (fd < 0)
+        return -1;
+    while ((size_t)total < cap - 1 && (n = read(fd, buf + total, cap - 1 - total)) > 0)
+        total += n;
+    close(fd);
+    buf[total] = '\0';
+    return total;
+}
+
+static long field_kb(const char *buf, const char *name)
+{
+    const char *line = strstr(buf, name);
+
+    return line ? atol(line + strlen(name)) : 0;
+}
+
+static void take_sample(t_sample *s)
+{
+    static char buf[1 << 16];
+    struct rusage usage;
+    long size = 0;
+    int fd;
+    ssize_t n;
+
+    memset(s, 0, sizeof(*s));
+    if (read_proc("/proc/self/smaps_rollup", buf, sizeof(buf)) > 0)
+    {
+        s->rss_kb = field_kb(buf, "\nRss:");
+        s->anon_kb = field_kb(buf, "\nAnonymous:");
+    }
+    if (read_proc("/proc/self/statm", buf, sizeof(buf)) > 0)
+    {
+        size = atol(buf);
+        s->mapped_kb = size * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+    // maps can be larger than the buffer: count lines chunk by chunk
+    if ((fd = open("/proc/self/maps", O_RDONLY)) >= 0)
+    {
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+        {
+            for (ssize_t i = 0; i < n; i++)
+                s->vmas += buf[i] == '\n';
+        }
+        close(fd);
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    s->minflt = usage.ru_minflt;
+    s->majflt = usage.ru_majflt;
+}
+
+static void *sampler(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        int phase = __atomic_load_n(&g_phase, __ATOMIC_ACQUIRE);
+        t_sample s;
+
+        if (phase == PHASE_DONE)
+            return NULL;
+        take_sample(&s);
+        if (s.rss_kb > g_peak_rss)
+            g_peak_rss = s.rss_kb;
+        printf("%s,%s,%.1f,%ld,%ld,%ld,%ld,%ld,%ld,%zu\n", g_label, g_phase_names[phase],
+               now_ms() - g_start, s.rss_kb, s.anon_kb, s.mapped_kb, s.vmas, s.minflt, s.majflt,
+               __atomic_load_n(&g_live_bytes, __ATOMIC_RELAXED) / 1024);
+        usleep(g_interval_ms * 1000);
+    }
+}
+
+static void end_phase(int next)
+{
+    take_sample(&g_phase_end[__atomic_load_n(&g_phase, __ATOMIC_RELAXED)]);
+    __atomic_store_n(&g_phase, next, __ATOMIC_RELEASE);
+}
+
+static void put_block(size_t i, size_t size)
+{
+    char *ptr = malloc(size);
+
+    // Write every page, as a program filling its buffers would
+    for (size_t off = 0; off < size; off += 4096)
+        ptr[off] = (char)i;
+    ptr[size - 1] = (char)i;
+    g_blocks[i] = ptr;
+    g_sizes[i] = size;
+    __atomic_fetch_add(&g_live_bytes, size, __ATOMIC_RELAXED);
+}
+
+static void drop_block(size_t i)
+{
+    free(g_blocks[i]);
+    g_blocks[i] = NULL;
+    __atomic_fetch_sub(&g_live_bytes, g_sizes[i], __ATOMIC_RELAXED);
+}
+
+int main(int argc, char **argv)
+{
+    size_t target;
+    size_t count = 0;
+    size_t spike_end;
+    long rest_ms = 2000;
+    pthread_t thread;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <label> [live MiB] [rest ms] [interval ms]\n", argv[0]);
+        return 1;
+    }
+    g_label = argv[1];
+    target = (argc > 2 ? (size_t)atol(argv[2]) : 64) * 1024 * 1024;
+    if (argc > 3)
+        rest_ms = atol(argv[3]);
+    if (argc > 4 && atol(argv[4]) > 0)
+        g_interval_ms = atol(argv[4]);
+    g_blocks = calloc(MAX_BLOCKS, sizeof(void *));
+    g_sizes = calloc(MAX_BLOCKS, sizeof(size_t));
+
+    g_start = now_ms();
+    pthread_create(&thread, NULL, sampler, NULL);
+
+    while (g_live_bytes < target && count < MAX_BLOCKS / (SPIKE_FACTOR + 1))
+        put_block(count++, random_size());
+    end_phase(PHASE_CHURN);
+
+    for (size_t i = 0; i < CHURN_ROUNDS * count; i++)
+    {
+        size_t k = next_random() % count;
+
+        drop_block(k);
+        put_block(k, random_size());
+    }
+    end_phase(PHASE_SPIKE);
+
+    // The spike is freed newest first, what was below it stays live
+    for (spike_end = count; g_live_bytes < (SPIKE_FACTOR + 1) * target && spike_end < MAX_BLOCKS; spike_end++)
+        put_block(spike_end, random_size());
+    while (spike_end > count)
+        drop_block(--spike_end);
+    end_phase(PHASE_DRAIN);
+
+    for (size_t i = count; i > 0; i--)
+    {
+        size_t k = next_random() % i;
+        void *ptr = g_blocks[k];
+        size_t size = g_sizes[k];
+
+        // Swap the freed block out of the first i
+        g_blocks[k] = g_blocks[i - 1];
+        g_sizes[k] = g_sizes[i - 1];
+        g_blocks[i - 1] = ptr;
+        g_sizes[i - 1] = size;
+        drop_block(i - 1);
+    }
+    end_phase(PHASE_REST);
+
+    usleep(rest_ms * 1000);
+    end_phase(PHASE_DONE);
+    pthread_join(thread, NULL);
+
+    fprintf(stderr, "%s: %zu blocks, %.0f ms, peak RSS %ld KiB\n", g_label, count, now_ms() - g_start, g_peak_rss);
+    fprintf(stderr, "%-6s %10s %10s %10s %6s %10s\n", "phase", "rss_kb", "anon_kb", "mapped_kb", "vmas", "minflt");
+    for (int p = 0; p < PHASE_DONE; p++)
+    {
+        t_sample *s = &g_phase_end[p];
+
+        fprintf(stderr, "%-6s %10ld %10ld %10ld %6ld %10ld\n", g_phase_names[p],
+                s->rss_kb, s->anon_kb, s->mapped_kb, s->vmas, s->minflt);
+    }
+    free(g_blocks);
+    free(g_sizes);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# Chronologie RSS / fautes de page / VMA: malloc custom vs glibc
+# Usage: ./test/bench_timeline.sh [live MiB] [repos ms] [intervalle ms]
+# BENCH_LIB désigne la bibliothèque à précharger (défaut: celle du Makefile)
+
+set -e
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+LIB="${BENCH_LIB:-./libft_malloc_${HOSTTYPE:-$(uname -m)_$(uname -s)}.so}"
+BIN="./bench_timeline"
+results_file="timeline_results.csv"
+plot_file="timeline.png"
+live_mb="${1:-64}"
+rest_ms="${2:-2000}"
+interval_ms="${3:-10}"
+
+if [ ! -f "$LIB" ]; then
+    echo -e "${RED}Library $LIB not found, build it with: make${NC}" >&2
+    exit 1
+fi
+
+echo -e "${BLUE}=== Memory Timeline Benchmark ===${NC}"
+echo "Live set: ${live_mb} MiB, rest: ${rest_ms} ms, sampled every ${interval_ms} ms"
+
+gcc -O2 -pthread -o "$BIN" test/bench_timeline.c
+trap 'rm -f "$BIN"' EXIT
+
+echo "allocator,phase,t_ms,rss_kb,anon_kb,mapped_kb,vmas,minflt,majflt,live_kb" > "$results_file"
+"$BIN" glibc "$live_mb" "$rest_ms" "$interval_ms" >> "$results_file"
+echo
+LD_PRELOAD="$LIB" "$BIN" libft "$live_mb" "$rest_ms" "$interval_ms" >> "$results_file"
+
+# Mémoire rendue après le pic: RSS en fin de repos / RSS maximal
+echo -e "\n${BLUE}=== Retention after the spike ===${NC}"
+awk -F, '
+    NR > 1 {
+        if ($4 > peak[$1]) peak[$1] = $4
+        last[$1] = $4
+        vmas[$1] = $7
+        if (!($1 in seen)) { seen[$1] = 1; order[++count] = $1 }
+    }
+    END {
+        for (i = 1; i <= count; i++) {
+            a = order[i]
+            printf "%-6s peak %8d KiB  after rest %8d KiB  retained %5.1f%%  vmas %d\n",
+                a, peak[a], last[a], 100 * last[a] / peak[a], vmas[a]
+        }
+    }' "$results_file"
+
+if command -v gnuplot > /dev/null; then
+    gnuplot <<EOF
+set datafile separator ","
+set terminal pngcairo size 1200,600
+set output "$plot_file"
+set xlabel "time (ms)"
+set ylabel "KiB"
+set key top right
+plot "< grep ^glibc, $results_file" using 3:4 with lines title "glibc RSS", \
+     "< grep ^libft, $results_file" using 3:4 with lines title "libft RSS", \
+     "< grep ^libft, $results_file" using 3:10 with lines dashtype 2 title "live (requested)"
+EOF
+    echo -e "${GREEN}Plot saved to $plot_file${NC}"
+fi
+
+echo -e "${GREEN}Results saved to $results_file${NC}"
@@ -0,0 +1,371 @@
+/*
+    * Allocator benchmark workloads, after the classic multi-threaded suites.
+    * Usage: bench_workloads <workload> <threads>
+    * Prints "<ops> <seconds> <peak RSS in KiB>" on one line. Run it as is for
+    * the system allocator, with LD_PRELOAD for libft_malloc (test/bench.sh).
+    *
+    *   larson        server-like churn: random sizes replaced in per-thread
+    *                 slot arrays, arrays handed to the next thread each round
+    *   xmalloc       producers allocate, consumers free (cross-thread frees)
+    *   cache-scratch objects first allocated by one thread then reused by
+    *                 others: passive false sharing
+    *   cache-thrash  small objects written in a tight loop by every thread:
+    *                 active false sharing
+    *   threadtest    batches of small objects allocated then freed in order
+    *   mstress       mixed sizes, some kept across rounds and swapped between
+    *                 threads, a few large ones
+*/
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define MAX_THREADS     64
+#define LARSON_SLOTS    1000
+#define LARSON_ROUNDS   20
+#define LARSON_OPS      20000       // Replacements per thread and round
+#define XMALLOC_RING    4096
+#define XMALLOC_ITEMS   1000000     // Blocks moved per producer/consumer pair
+#define CACHE_ITERS     200000
+#define CACHE_WRITES    50
+#define CACHE_SIZE      8
+#define THREADTEST_ITERS 100
+#define THREADTEST_BATCH 10000
+#define MSTRESS_SLOTS   2000
+#define MSTRESS_ROUNDS  10
+#define MSTRESS_OPS     50000
+
+typedef struct s_worker {
+    pthread_t       thread;
+    int             id;
+    int             threads;
+    uint64_t        rng;
+    size_t          ops;
+} t_worker;
+
+static pthread_barrier_t    g_barrier;
+static void                 **g_larson_slots[MAX_THREADS];
+static void                 **g_mstress_shared;
+static char                 *g_scratch[MAX_THREADS];
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void touch(char *ptr, size_t size)
+{
+    // Write the first and last byte so pages are really used
+    ptr[0] = (char)size;
+    ptr[size - 1] = (char)size;
+}
+
+/* larson */
+
+static void *larson(void *arg)
+{
+    t_worker *w = arg;
+
+    for (int round = 0; round < LARSON_ROUNDS; round++)
+    {
+        void **slots = g_larson_slots[(w->id + round) % w->threads];
+
+        for (int i = 0; i < LARSON_OPS; i++)
+        {
+            size_t k = next_random(&w->rng) % LARSON_SLOTS;
+            size_t size = 10 + next_random(&w->rng) % 1000;
+
+            free(slots[k]);
+            slots[k] = malloc(size);
+            touch(slots[k], size);
+            w->ops += 2;
+        }
+        // Every thread moves on to the slots its neighbour just used
+        pthread_barrier_wait(&g_barrier);
+    }
+    return NULL;
+}
+
+static void larson_setup(int threads)
+{
+    uint64_t rng = 42;
+
+    for (int t = 0; t < threads; t++)
+    {
+        g_larson_slots[t] = calloc(LARSON_SLOTS, sizeof(void *));
+        for (int k = 0; k < LARSON_SLOTS; k++)
+            g_larson_slots[t][k] = malloc(10 + next_random(&rng) % 1000);
+    }
+}
+
+static void larson_teardown(int threads)
+{
+    for (int t = 0; t < threads; t++)
+    {
+        for (int k = 0; k < LARSON_SLOTS; k++)
+            free(g_larson_slots[t][k]);
+        free(g_larson_slots[t]);
+    }
+}
+
+/* xmalloc: thread 2i produces for thread 2i+1 through a ring */
+
+typedef struct s_ring {
+    void            *items[XMALLOC_RING];
+    size_t          head;
+    size_t          tail;
+} t_ring;
+
+static t_ring g_rings[MAX_THREADS / 2 + 1];
+
+static void *xmalloc(void *arg)
+{
+    t_worker *w = arg;
+    t_ring *ring = &g_rings[w->id / 2];
+    size_t items = XMALLOC_ITEMS / ((w->threads + 1) / 2);
+
+    for (size_t i = 0; i < items; i++)
+    {
+        if (w->id % 2 == 0)
+        {
+            size_t size = 16 + next_random(&w->rng) % 240;
+            char *ptr = malloc(size);
+
+            touch(ptr, size);
+            while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail >= XMALLOC_RING)
+                sched_yield();
+            ring->items[ring->head % XMALLOC_RING] = ptr;
+            __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+                sched_yield();
+            free(ring->items[ring->tail % XMALLOC_RING]);
+            __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+        }
+        w->ops++;
+    }
+    return NULL;
+}
+
+/* cache-scratch and cache-thrash */
+
+static void write_loop(char *ptr)
+{
+    for (int j = 0; j < CACHE_WRITES; j++)
+    {
+        for (int b = 0; b < CACHE_SIZE; b++)
+            ((volatile char *)ptr)[b]++;
+    }
+}
+
+static void *cache_scratch(void *arg)
+{
+    t_worker *w = arg;
+    char *ptr = g_scratch[w->id];
+
+    // Start from an object the main thread allocated next to the others'
+    free(ptr);
+    for (int i = 0; i < CACHE_ITERS; i++)
+    {
+        ptr = malloc(CACHE_SIZE);
+        write_loop(ptr);
+        free(ptr);
+        w->ops += 2;
+    }
+    return NULL;
+}
+
+static void *cache_thrash(void *arg)
+{
+    t_worker *w = arg;
+
+    for (int i = 0; i < CACHE_ITERS; i++)
+    {
+        char *ptr = malloc(CACHE_SIZE);
+
+        write_loop(ptr);
+        free(ptr);
+        w->ops += 2;
+    }
+    return NULL;
+}
+
+/* threadtest */
+
+static void *threadtest(void *arg)
+{
+    t_worker *w = arg;
+    size_t batch = THREADTEST_BATCH / w->threads;
+    char **objects = malloc(batch * sizeof(char *));
+
+    for (int i = 0; i < THREADTEST_ITERS; i++)
+    {
+        for (size_t j = 0; j < batch; j++)
+        {
+            objects[j] = malloc(8);
+            objects[j][0] = (char)j;
+        }
+        for (size_t j = 0; j < batch; j++)
+            free(objects[j]);
+        w->ops += batch * 2;
+    }
+    free(objects);
+    return NULL;
+}
+
+/* mstress */
+
+static size_t mstress_size(uint64_t *rng)
+{
+    uint64_t r = next_random(rng);
+
+    // Mostly small, some medium, one in a thousand large
+    if (r % 1000 == 0)
+        return 64 * 1024 + r % (1024 * 1024);
+    if (r % 10 == 0)
+        return 512 + r % 8192;
+    return 8 + r % 256;
+}
+
+static void *mstress(void *arg)
+{
+    t_worker *w = arg;
+    void **slots = calloc(MSTRESS_SLOTS, sizeof(void *));
+
+    for (int round = 0; round < MSTRESS_ROUNDS; round++)
+    {
+        for (int i = 0; i < MSTRESS_OPS; i++)
+        {
+            size_t k = next_random(&w->rng) % MSTRESS_SLOTS;
+            uint64_t r = next_random(&w->rng);
+
+            if (r % 100 < 3)
+            {
+                // Swap with the shared pool: the block is freed by someone else
+                k = next_random(&w->rng) % MSTRESS_SLOTS;
+                slots[k] = __atomic_exchange_n(&g_mstress_shared[k], slots[k], __ATOMIC_ACQ_REL);
+            }
+            else if (slots[k] && r % 100 < 50)
+            {
+                free(slots[k]);
+                slots[k] = NULL;
+            }
+            else
+            {
+                size_t size = mstress_size(&w->rng);
+
+                free(slots[k]);
+                slots[k] = malloc(size);
+                touch(slots[k], size);
+            }
+            w->ops++;
+        }
+        // Drop half of what this thread holds between rounds
+        for (size_t k = round % 2; k < MSTRESS_SLOTS; k += 2)
+        {
+            free(slots[k]);
+            slots[k] = NULL;
+        }
+    }
+    for (size_t k = 0; k < MSTRESS_SLOTS; k++)
+        free(slots[k]);
+    free(slots);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static t_worker workers[MAX_THREADS];
+    void *(*run)(void *) = NULL;
+    struct rusage usage;
+    const char *name;
+    size_t ops = 0;
+    int threads;
+
+    if (argc != 3 || (threads = atoi(argv[2])) < 1 || threads > MAX_THREADS)
+    {
+        fprintf(stderr, "usage: %s <larson|xmalloc|cache-scratch|cache-thrash|threadtest|mstress> <threads 1-%d>\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+    name = argv[1];
+    if (!strcmp(name, "larson"))
+        run = larson;
+    else if (!strcmp(name, "xmalloc"))
+        run = xmalloc;
+    else if (!strcmp(name, "cache-scratch"))
+        run = cache_scratch;
+    else if (!strcmp(name, "cache-thrash"))
+        run = cache_thrash;
+    else if (!strcmp(name, "threadtest"))
+        run = threadtest;
+    else if (!strcmp(name, "mstress"))
+        run = mstress;
+    if (!run)
+    {
+        fprintf(stderr, "unknown workload: %s\n", name);
+        return 1;
+    }
+
+    // Producers need a consumer
+    if (run == xmalloc && threads % 2)
+        threads++;
+    pthread_barrier_init(&g_barrier, NULL, threads);
+    if (run == larson)
+        larson_setup(threads);
+    if (run == mstress)
+        g_mstress_shared = calloc(MSTRESS_SLOTS, sizeof(void *));
+    if (run == cache_scratch)
+    {
+        for (int t = 0; t < threads; t++)
+            g_scratch[t] = malloc(CACHE_SIZE);
+    }
+
+    double start = now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t].id = t;
+        workers[t].threads = threads;
+        workers[t].rng = 0x9E3779B97F4A7C15ULL * (t + 1);
+        pthread_create(&workers[t].thread, NULL, run, &workers[t]);
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        ops += workers[t].ops;
+    }
+    double elapsed = now() - start;
+
+    if (run == larson)
+        larson_teardown(threads);
+    if (run == mstress)
+    {
+        for (size_t k = 0; k < MSTRESS_SLOTS; k++)
+            free(g_mstress_shared[k]);
+        free(g_mstress_shared);
+    }
+    pthread_barrier_destroy(&g_barrier);
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%zu %.6f %ld\n", ops, elapsed, usage.ru_maxrss);
+    return 0;
+}
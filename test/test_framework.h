@@ -75,5 +75,28 @@ void test_multiple_allocations(void);
 void test_fragmentation(void);
 void test_stress_test(void);
 void test_page_overhead(void);
+void test_thread_cache(void);
+void test_cross_thread_free(void);
+void test_tiny_size_classes(void);
+void test_small_free_lists(void);
+void test_foreign_pointers(void);
+void test_empty_zone_release(void);
+void test_coalesce_previous(void);
+void test_large_cache(void);
+void test_realloc_in_place(void);
+void test_calloc(void);
+void test_aligned_alloc(void);
+void test_usable_size_and_sized_free(void);
+void test_remote_free_pipeline(void);
+void test_reserved_range(void);
+void test_copy_kernels(void);
+void test_stats_api(void);
+void test_heap_profile(void);
+void test_trace_recording(void);
+void test_zone_info(void);
+void test_scribble_grow_calloc(void);
+void test_sized_free_check(void);
+void test_chunk_backend(void);
+void test_mallinfo_cross_thread(void);
 
 #endif
@@ -23,6 +23,29 @@ int main(void)
     test_fragmentation();
     test_stress_test();
     test_page_overhead();
+    test_thread_cache();
+    test_cross_thread_free();
+    test_tiny_size_classes();
+    test_small_free_lists();
+    test_foreign_pointers();
+    test_empty_zone_release();
+    test_coalesce_previous();
+    test_large_cache();
+    test_realloc_in_place();
+    test_calloc();
+    test_aligned_alloc();
+    test_usable_size_and_sized_free();
+    test_remote_free_pipeline();
+    test_reserved_range();
+    test_copy_kernels();
+    test_stats_api();
+    test_heap_profile();
+    test_trace_recording();
+    test_zone_info();
+    test_scribble_grow_calloc();
+    test_sized_free_check();
+    test_chunk_backend();
+    test_mallinfo_cross_thread();
     
     // Print summary
     TEST_SUMMARY();
@@ -0,0 +1,550 @@
+/*
+    * Replay an allocation trace recorded with MALLOC_TRACE.
+    * Usage: trace_replay [-l allocator.so] <file.trace>
+    * Without -l the calls go to the allocator the tool runs with (glibc, or
+    * whatever LD_PRELOAD holds); -l re-executes the tool with that library
+    * preloaded.
+    * Each recorded thread is replayed by a thread of its own, in its recorded
+    * order. A free or realloc of a block allocated by another thread waits
+    * until that allocation was replayed, so every block is handed over like
+    * in the original run. The trace is decoded before the replay starts and
+    * the tool's own tables are mapped with mmap(), out of the measured heap.
+    * Reports the replay time, the peak of live requested bytes (a property
+    * of the trace), how much the RSS grew at its peak and at the end, and
+    * their ratio: the memory the allocator needed per byte the program held.
+*/
+#include "../include/malloc.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NO_SLOT         UINT32_MAX
+#define SAMPLE_USEC     5000        // RSS sampling period during the replay
+#define REEXEC_ENV      "TRACE_REPLAY_PRELOADED"
+
+typedef struct s_event {
+    uint64_t        time;            // Allocations: return, free/realloc: entry
+    uint64_t        done;            // Return of a realloc, time otherwise
+    uint64_t        size;
+    uint64_t        extra;           // Alignment
+    uintptr_t       in;
+    uintptr_t       out;
+    uint32_t        thread;
+    uint32_t        in_slot;
+    uint32_t        out_slot;
+    uint8_t         op;
+    bool            null;            // The recorded call returned NULL
+} t_event;
+
+/* An address taken (produce) or let go (consume) at some time */
+typedef struct s_happening {
+    uint64_t        time;
+    uint32_t        event;
+    uint32_t        produce;
+} t_happening;
+
+typedef struct s_slot {
+    void            *ptr;
+    int             ready;
+} t_slot;
+
+typedef struct s_replayer {
+    pthread_t       thread;
+    uint32_t        *events;         // Indexes into g_events, in recorded order
+    size_t          count;
+} t_replayer;
+
+static t_event          *g_events;
+static size_t           g_event_count;
+static t_slot           *g_slots;
+static t_replayer       *g_replayers;
+static uint32_t         g_thread_count;
+static pthread_barrier_t g_start;
+static long             g_page;
+
+/* Memory for the tool's tables, zeroed, never from the allocator under test */
+static void *table(size_t size)
+{
+    void *ptr = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ptr == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+    return ptr;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Resident set in KiB, from statm */
+static long rss_kb(void)
+{
+    char buf[128];
+    long size = 0;
+    long resident = 0;
+    int fd = open("/proc/self/statm", O_RDONLY);
+    ssize_t n;
+
+    if (fd < 0)
+        return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+    sscanf(buf, "%ld %ld", &size, &resident);
+    return resident * (g_page / 1024);
+}
+
+/* Decoding */
+
+typedef struct s_cursor {
+    const uint8_t   *p;
+    const uint8_t   *end;
+    bool            bad;
+} t_cursor;
+
+typedef struct s_thread_state {
+    uint64_t        last_time;
+    uintptr_t       last_ptr;
+} t_thread_state;
+
+static uint64_t get_varint(t_cursor *c)
+{
+    uint64_t v = 0;
+
+    for (int shift = 0; c->p < c->end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *c->p++;
+
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+    c->bad = true;
+    return 0;
+}
+
+static uintptr_t get_ptr(t_cursor *c, t_thread_state *state)
+{
+    uint64_t z = get_varint(c);
+    int64_t delta = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+
+    state->last_ptr += (uintptr_t)delta;
+    return state->last_ptr;
+}
+
+/* Decode one event, or count it when out is NULL */
+static void get_event(t_cursor *c, t_thread_state *state, uint32_t thread, t_event *out)
+{
+    t_event e = {0};
+    uint8_t op = *c->p++;
+
+    e.op = op & ~TRACE_NULL;
+    e.null = op & TRACE_NULL;
+    e.thread = thread;
+    e.in_slot = NO_SLOT;
+    e.out_slot = NO_SLOT;
+    state->last_time += get_varint(c);
+    e.time = e.done = state->last_time;
+    if (e.op > TRACE_FREE)
+        c->bad = true;
+    if (e.op == TRACE_FREE || e.op == TRACE_REALLOC)
+        e.in = get_ptr(c, state);
+    if (e.op != TRACE_FREE)
+    {
+        e.size = get_varint(c);
+        if (e.op == TRACE_ALIGNED)
+            e.extra = get_varint(c);
+        if (e.op == TRACE_REALLOC)
+            e.done = e.time + get_varint(c);
+        if (!e.null)
+            e.out = get_ptr(c, state);
+    }
+    if (out)
+        *out = e;
+}
+
+/* Walk the chunks twice: count, then decode. Returns false on a damaged file */
+static bool decode(const uint8_t *data, size_t len)
+{
+    const t_trace_header *header = (const t_trace_header *)data;
+    t_thread_state *states = NULL;
+
+    if (len < sizeof(*header) || memcmp(header->magic, TRACE_MAGIC, 8) || header->version != TRACE_VERSION)
+    {
+        fprintf(stderr, "not a version %d allocation trace\n", TRACE_VERSION);
+        return false;
+    }
+    for (int pass = 0; pass < 2; pass++)
+    {
+        size_t off = sizeof(*header);
+        size_t n = 0;
+
+        if (pass == 1)
+        {
+            g_events = table(g_event_count * sizeof(t_event));
+            states = table(g_thread_count * sizeof(t_thread_state));
+        }
+        while (off + sizeof(t_trace_chunk) <= len)
+        {
+            t_trace_chunk chunk;
+
+            memcpy(&chunk, data + off, sizeof(chunk));
+            off += sizeof(chunk);
+            if (chunk.length > len - off)
+                return false;
+            t_cursor c = { data + off, data + off + chunk.length, false };
+            t_thread_state scratch = {0};
+
+            if (chunk.thread >= g_thread_count)
+                g_thread_count = chunk.thread + 1;
+            // The first pass only counts, the deltas need not add up
+            while (c.p < c.end && !c.bad)
+            {
+                get_event(&c, pass ? &states[chunk.thread] : &scratch, chunk.thread, pass ? &g_events[n] : NULL);
+                n++;
+            }
+            if (c.bad)
+                return false;
+            off += chunk.length;
+        }
+        g_event_count = n;
+    }
+    return true;
+}
+
+/* Happenings sorted by time, lets go before takes at the same stamp */
+static bool happens_before(const t_happening *a, const t_happening *b)
+{
+    if (a->time != b->time)
+        return a->time < b->time;
+    if (a->produce != b->produce)
+        return a->produce < b->produce;
+    return a->event < b->event;
+}
+
+static void sort_happenings(t_happening *h, size_t n)
+{
+    t_happening *tmp = table(n * sizeof(*h));
+
+    // Bottom-up merge sort, stable
+    for (size_t width = 1; width < n; width *= 2)
+    {
+        for (size_t lo = 0; lo < n; lo += 2 * width)
+        {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+
+            while (i < mid && j < hi)
+                tmp[k++] = happens_before(&h[j], &h[i]) ? h[j++] : h[i++];
+            while (i < mid)
+                tmp[k++] = h[i++];
+            while (j < hi)
+                tmp[k++] = h[j++];
+        }
+        memcpy(h, tmp, n * sizeof(*h));
+    }
+    munmap(tmp, n * sizeof(*h));
+}
+
+/* Address to slot, open addressing with backward-shift deletion */
+typedef struct s_addr_map {
+    uintptr_t       *keys;
+    uint32_t        *slots;
+    size_t          mask;
+} t_addr_map;
+
+static size_t addr_hash(t_addr_map *m, uintptr_t addr)
+{
+    return (size_t)((addr >> 4) * 0x9E3779B97F4A7C15ULL >> 20) & m->mask;
+}
+
+static uint32_t map_take(t_addr_map *m, uintptr_t addr)
+{
+    size_t i = addr_hash(m, addr);
+
+    while (m->keys[i] && m->keys[i] != addr)
+        i = (i + 1) & m->mask;
+    if (!m->keys[i])
+        return NO_SLOT;
+    uint32_t slot = m->slots[i];
+
+    // Pull later entries of the run back over the hole
+    for (size_t j = (i + 1) & m->mask; m->keys[j]; j = (j + 1) & m->mask)
+    {
+        size_t home = addr_hash(m, m->keys[j]);
+
+        if (((j - home) & m->mask) >= ((j - i) & m->mask))
+        {
+            m->keys[i] = m->keys[j];
+            m->slots[i] = m->slots[j];
+            i = j;
+        }
+    }
+    m->keys[i] = 0;
+    return slot;
+}
+
+static void map_put(t_addr_map *m, uintptr_t addr, uint32_t slot)
+{
+    size_t i = addr_hash(m, addr);
+
+    while (m->keys[i] && m->keys[i] != addr)
+        i = (i + 1) & m->mask;
+    m->keys[i] = addr;
+    m->slots[i] = slot;
+}
+
+typedef struct s_trace_info {
+    size_t          peak_live;
+    size_t          final_live;
+    size_t          slots;
+    size_t          unmatched;       // Frees and reallocs of unknown addresses
+    size_t          unmatched_reallocs; // Part of them replayed as a malloc
+} t_trace_info;
+
+/*
+    * Follow the addresses in time order: each allocation fills a new slot,
+    * the free or realloc that lets go of the address consumes it.
+*/
+static t_trace_info link_slots(void)
+{
+    t_trace_info info = {0};
+    size_t n = 0;
+    t_happening *h = table(2 * g_event_count * sizeof(*h));
+    size_t capacity = 16;
+    t_addr_map map;
+    size_t *sizes;
+    size_t live = 0;
+
+    for (size_t i = 0; i < g_event_count; i++)
+    {
+        t_event *e = &g_events[i];
+
+        if (e->op == TRACE_FREE || (e->op == TRACE_REALLOC && e->in))
+            h[n++] = (t_happening){ e->time, (uint32_t)i, 0 };
+        if (e->op != TRACE_FREE && !e->null)
+            h[n++] = (t_happening){ e->done, (uint32_t)i, 1 };
+    }
+    sort_happenings(h, n);
+
+    while (capacity < 2 * g_event_count)
+        capacity *= 2;
+    map.keys = table(capacity * sizeof(uintptr_t));
+    map.slots = table(capacity * sizeof(uint32_t));
+    map.mask = capacity - 1;
+    sizes = table(g_event_count * sizeof(size_t));
+
+    for (size_t i = 0; i < n; i++)
+    {
+        t_event *e = &g_events[h[i].event];
+
+        if (!h[i].produce)
+        {
+            e->in_slot = map_take(&map, e->in);
+            if (e->in_slot == NO_SLOT)
+            {
+                info.unmatched++;
+                info.unmatched_reallocs += e->op == TRACE_REALLOC;
+            }
+            else
+                live -= sizes[e->in_slot];
+            continue;
+        }
+        e->out_slot = (uint32_t)info.slots++;
+        sizes[e->out_slot] = e->size;
+        live += e->size;
+        if (live > info.peak_live)
+            info.peak_live = live;
+        // An address given out twice: the block before was never freed
+        uint32_t stale = map_take(&map, e->out);
+        if (stale != NO_SLOT)
+            live -= sizes[stale];
+        map_put(&map, e->out, e->out_slot);
+    }
+    info.final_live = live;
+    munmap(h, 2 * g_event_count * sizeof(*h));
+    return info;
+}
+
+/* Replay */
+
+static void touch_pages(char *ptr, size_t size)
+{
+    for (size_t off = 0; off < size; off += (size_t)g_page)
+        ptr[off] = 1;
+    if (size)
+        ptr[size - 1] = 1;
+}
+
+static void *replay_thread(void *arg)
+{
+    t_replayer *r = (t_replayer *)arg;
+
+    pthread_barrier_wait(&g_start);
+    for (size_t i = 0; i < r->count; i++)
+    {
+        t_event *e = &g_events[r->events[i]];
+        void *in = NULL;
+        void *out = NULL;
+
+        // The block comes from another thread: wait for it to exist. An
+        // unknown block is skipped by free and makes realloc a malloc
+        if (e->in_slot != NO_SLOT)
+        {
+            while (!__atomic_load_n(&g_slots[e->in_slot].ready, __ATOMIC_ACQUIRE))
+                sched_yield();
+            in = g_slots[e->in_slot].ptr;
+        }
+        if (e->op == TRACE_MALLOC)
+            out = malloc(e->size);
+        else if (e->op == TRACE_CALLOC)
+            out = calloc(1, e->size);
+        else if (e->op == TRACE_ALIGNED)
+            out = memalign(e->extra, e->size);
+        else if (e->op == TRACE_REALLOC)
+            out = realloc(in, e->size);
+        else if (in)
+            free(in);
+
+        if (out && e->op != TRACE_CALLOC)
+            touch_pages(out, e->size);
+        if (e->out_slot != NO_SLOT)
+        {
+            g_slots[e->out_slot].ptr = out;
+            __atomic_store_n(&g_slots[e->out_slot].ready, 1, __ATOMIC_RELEASE);
+        }
+        else if (out)
+            free(out);  // Failed when recorded, nobody will free it
+    }
+    return NULL;
+}
+
+static void preload(char **argv, const char *lib)
+{
+    char *resolved = realpath(lib, NULL);
+
+    if (!resolved)
+    {
+        perror(lib);
+        exit(1);
+    }
+    setenv("LD_PRELOAD", resolved, 1);
+    setenv(REEXEC_ENV, "1", 1);
+    unsetenv("MALLOC_TRACE");
+    execv("/proc/self/exe", argv);
+    perror("execv");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *lib = NULL;
+    const char *path;
+    struct stat st;
+    int opt;
+    int fd;
+
+    while ((opt = getopt(argc, argv, "l:")) != -1)
+    {
+        if (opt == 'l')
+            lib = optarg;
+        else
+            return fprintf(stderr, "usage: %s [-l allocator.so] <file.trace>\n", argv[0]), 1;
+    }
+    if (optind != argc - 1)
+        return fprintf(stderr, "usage: %s [-l allocator.so] <file.trace>\n", argv[0]), 1;
+    if (lib && !getenv(REEXEC_ENV))
+        preload(argv, lib);
+    unsetenv("MALLOC_TRACE");
+    path = argv[optind];
+    g_page = sysconf(_SC_PAGESIZE);
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        return perror(path), 1;
+    const uint8_t *data = table(st.st_size);
+    if (read(fd, (void *)data, st.st_size) != st.st_size)
+        return perror(path), 1;
+    close(fd);
+    if (!decode(data, st.st_size))
+        return fprintf(stderr, "%s: damaged trace\n", path), 1;
+
+    t_trace_info info = link_slots();
+    g_slots = table(info.slots * sizeof(t_slot));
+    g_replayers = table(g_thread_count * sizeof(t_replayer));
+    for (size_t i = 0; i < g_event_count; i++)
+        g_replayers[g_events[i].thread].count++;
+    for (uint32_t t = 0; t < g_thread_count; t++)
+    {
+        g_replayers[t].events = table(g_replayers[t].count * sizeof(uint32_t));
+        g_replayers[t].count = 0;
+    }
+    for (size_t i = 0; i < g_event_count; i++)
+    {
+        t_replayer *r = &g_replayers[g_events[i].thread];
+
+        r->events[r->count++] = (uint32_t)i;
+    }
+
+    // Everything the tool needs is resident: RSS growth from here is the heap
+    long base_rss = rss_kb();
+    long peak_rss = base_rss;
+
+    pthread_barrier_init(&g_start, NULL, g_thread_count + 1);
+    for (uint32_t t = 0; t < g_thread_count; t++)
+    {
+        if (pthread_create(&g_replayers[t].thread, NULL, replay_thread, &g_replayers[t]) != 0)
+            return fprintf(stderr, "cannot start replay thread %u\n", t), 1;
+    }
+    pthread_barrier_wait(&g_start);
+    double start = now();
+    for (uint32_t t = 0; t < g_thread_count; t++)
+    {
+        // Sample while waiting, the first threads usually finish last
+        while (pthread_tryjoin_np(g_replayers[t].thread, NULL) != 0)
+        {
+            long rss = rss_kb();
+
+            if (rss > peak_rss)
+                peak_rss = rss;
+            usleep(SAMPLE_USEC);
+        }
+    }
+    double elapsed = now() - start;
+    long end_rss = rss_kb();
+
+    if (end_rss > peak_rss)
+        peak_rss = end_rss;
+
+    printf("allocator:        %s\n", getenv("LD_PRELOAD") ? getenv("LD_PRELOAD") : "system");
+    printf("events:           %zu (%u threads)\n", g_event_count, g_thread_count);
+    printf("unmatched:        %zu frees and reallocs of unknown blocks (%zu reallocs replayed as malloc)\n",
+           info.unmatched, info.unmatched_reallocs);
+    printf("time:             %.3f s (%.0f ops/s)\n", elapsed, g_event_count / elapsed);
+    printf("peak live:        %zu KiB requested\n", info.peak_live / 1024);
+    printf("peak RSS growth:  %ld KiB\n", peak_rss - base_rss);
+    printf("final live:       %zu KiB requested\n", info.final_live / 1024);
+    printf("final RSS growth: %ld KiB\n", end_rss - base_rss);
+    if (info.peak_live >= 1024)
+        printf("fragmentation:    %.2f (peak RSS growth / peak live)\n",
+               (double)(peak_rss - base_rss) / (info.peak_live / 1024));
+    return 0;
+}
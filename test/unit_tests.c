@@ -1,4 +1,9 @@
 #include "test_framework.h"
+#include <pthread.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <sched.h>
+#include <fcntl.h>
 
 // Global test counters
 int g_tests_run = 0;
@@ -238,3 +243,1375 @@ void test_page_overhead(void)
     
     TEST_END();
 }
+
+static void *thread_cache_worker(void *arg)
+{
+    char *ptrs[64];
+
+    (void)arg;
+    for (int round = 0; round < 100; round++)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            ptrs[i] = malloc(16 + (i % 8) * 16);
+            if (!ptrs[i])
+                return (void *)1;
+            memset(ptrs[i], i, 16);
+        }
+        for (int i = 0; i < 64; i++)
+        {
+            if (ptrs[i][15] != (char)i)
+                return (void *)1;
+            free(ptrs[i]);
+        }
+    }
+    return NULL;
+}
+
+void test_thread_cache(void)
+{
+    TEST_START("Thread cache reuse and thread exit");
+
+    char *ptr = malloc(64);
+    TEST_ASSERT(ptr != NULL, "malloc(64) should succeed");
+    free(ptr);
+    char *again = malloc(64);
+    TEST_ASSERT(again == ptr, "A freed block should be handed back to the same thread");
+    free(again);
+
+    pthread_t threads[4];
+    void *ret;
+    int failed = 0;
+    for (int i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, thread_cache_worker, NULL);
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], &ret);
+        failed += (ret != NULL);
+    }
+    TEST_ASSERT(failed == 0, "Threads should keep their data intact and exit cleanly");
+
+    TEST_END();
+}
+
+static void *cross_thread_producer(void *arg)
+{
+    void **ptrs = (void **)arg;
+
+    for (int i = 0; i < 32; i++)
+    {
+        ptrs[i] = malloc(i < 16 ? 200 : (i < 24 ? 2000 : 20000));
+        if (ptrs[i])
+            memset(ptrs[i], 0x5A, 200);
+    }
+    return NULL;
+}
+
+/* Frees the producer's blocks, its thread cache is emptied into their arena on exit */
+static void *cross_thread_consumer(void *arg)
+{
+    void **ptrs = (void **)arg;
+
+    for (int i = 0; i < 32; i++)
+    {
+        if (!ptrs[i] || ((unsigned char *)ptrs[i])[199] != 0x5A)
+            return (void *)1;
+        free(ptrs[i]);
+    }
+    return NULL;
+}
+
+void test_cross_thread_free(void)
+{
+    TEST_START("Free from a different thread than malloc");
+
+    void *ptrs[32] = {0};
+    void *again[32] = {0};
+    void *ret;
+    pthread_t thread;
+    pthread_create(&thread, NULL, cross_thread_producer, ptrs);
+    pthread_join(thread, NULL);
+    for (int i = 0; i < 32; i++)
+        TEST_ASSERT(ptrs[i] != NULL, "Producer allocations should succeed");
+
+    pthread_create(&thread, NULL, cross_thread_consumer, ptrs);
+    pthread_join(thread, &ret);
+    TEST_ASSERT(ret == NULL, "Data written by the producer should be visible to the consumer");
+
+    // A new thread is bound to the arena the producer left: the same
+    // requests should be served from the blocks it got back
+    pthread_create(&thread, NULL, cross_thread_producer, again);
+    pthread_join(thread, NULL);
+    int reused = 0;
+    for (int i = 0; i < 32; i++)
+    {
+        for (int j = 0; j < 32; j++)
+            reused += again[i] && again[i] == ptrs[j];
+    }
+    TEST_ASSERT(reused == 32, "Blocks should be returned to the arena that owns them");
+    for (int i = 0; i < 32; i++)
+        free(again[i]);
+
+    TEST_END();
+}
+
+void test_tiny_size_classes(void)
+{
+    TEST_START("TINY size classes");
+
+    #define TINY_COUNT 300
+    unsigned char *ptrs[TINY_COUNT];
+
+    // Every TINY size, several slabs worth of the same class
+    for (int i = 0; i < TINY_COUNT; i++)
+    {
+        size_t size = 1 + (i * 7) % 512;
+        ptrs[i] = malloc(size);
+        TEST_ASSERT(ptrs[i] != NULL, "TINY allocation should succeed");
+        TEST_ASSERT(((uintptr_t)ptrs[i] & 15) == 0, "TINY allocation should be 16-byte aligned");
+        memset(ptrs[i], i & 0xFF, size);
+    }
+    for (int i = 0; i < TINY_COUNT; i++)
+    {
+        size_t size = 1 + (i * 7) % 512;
+        TEST_ASSERT(ptrs[i][0] == (i & 0xFF) && ptrs[i][size - 1] == (i & 0xFF),
+                    "TINY slots should not overlap");
+    }
+    for (int i = 0; i < TINY_COUNT; i += 2)
+        free(ptrs[i]);
+    for (int i = 0; i < TINY_COUNT; i += 2)
+    {
+        ptrs[i] = malloc(1 + (i * 7) % 512);
+        TEST_ASSERT(ptrs[i] != NULL, "Freed slots should be reusable");
+    }
+    for (int i = 0; i < TINY_COUNT; i++)
+        free(ptrs[i]);
+
+    TEST_END();
+}
+
+void test_small_free_lists(void)
+{
+    TEST_START("SMALL free lists");
+
+    #define SMALL_COUNT 2000
+    static unsigned char *ptrs[SMALL_COUNT];
+
+    for (int i = 0; i < SMALL_COUNT; i++)
+    {
+        size_t size = 513 + (i * 37) % 3584;
+        ptrs[i] = malloc(size);
+        TEST_ASSERT(ptrs[i] != NULL, "SMALL allocation should succeed");
+        ptrs[i][0] = (unsigned char)i;
+        ptrs[i][size - 1] = (unsigned char)i;
+    }
+
+    // Punch holes of every size, then refill them with different sizes
+    for (int i = 0; i < SMALL_COUNT; i += 3)
+        free(ptrs[i]);
+    for (int i = 0; i < SMALL_COUNT; i += 3)
+    {
+        size_t size = 513 + (i * 53) % 3584;
+        ptrs[i] = malloc(size);
+        TEST_ASSERT(ptrs[i] != NULL, "Allocation into freed SMALL space should succeed");
+        ptrs[i][0] = (unsigned char)i;
+        ptrs[i][size - 1] = (unsigned char)i;
+    }
+
+    for (int i = 0; i < SMALL_COUNT; i++)
+    {
+        size_t size = 513 + (i * (i % 3 == 0 ? 53 : 37)) % 3584;
+        TEST_ASSERT(ptrs[i][0] == (unsigned char)i && ptrs[i][size - 1] == (unsigned char)i,
+                    "SMALL blocks should not overlap");
+    }
+    for (int i = 0; i < SMALL_COUNT; i++)
+        free(ptrs[i]);
+
+    TEST_END();
+}
+
+void test_foreign_pointers(void)
+{
+    TEST_START("Pointers not owned by the allocator");
+
+    char on_stack[64];
+    static char in_data[64];
+    // volatile keeps the compiler from rejecting the obviously bad free()
+    void *volatile foreign;
+    uintptr_t (*lookup)(const void *) = (uintptr_t (*)(const void *))dlsym(RTLD_DEFAULT, "pagemap_get");
+    void (*get_stats)(t_malloc_stats *)
+        = (void (*)(t_malloc_stats *))dlsym(RTLD_DEFAULT, "malloc_get_stats");
+    t_malloc_stats before;
+    t_malloc_stats after;
+
+    TEST_ASSERT(lookup && get_stats, "pagemap_get and malloc_get_stats should be exported");
+    TEST_ASSERT(lookup(on_stack) == 0 && lookup(in_data) == 0,
+                "The page map should not own stack or static addresses");
+
+    get_stats(&before);
+    foreign = on_stack;
+    free(foreign);
+    foreign = in_data;
+    free(foreign);
+    get_stats(&after);
+    TEST_ASSERT(after.frees == before.frees && after.bytes_in_use == before.bytes_in_use,
+                "free() of a stack or static address should be ignored");
+
+    char *large = malloc(64 * 1024);
+    TEST_ASSERT(large != NULL, "LARGE allocation should succeed");
+    TEST_ASSERT(lookup(large + 8192) == 0, "Only the first page of a LARGE block is registered");
+    get_stats(&before);
+    foreign = large + 8192;
+    free(foreign);
+    get_stats(&after);
+    TEST_ASSERT(after.frees == before.frees, "free() of an interior LARGE pointer should not count as a free");
+    large[0] = 'L';
+    large[64 * 1024 - 1] = 'L';
+    TEST_ASSERT(large[0] == 'L', "free() of an interior LARGE pointer should be ignored");
+    free(large);
+
+    TEST_END();
+}
+
+static size_t resident_pages(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    size_t size = 0, resident = 0;
+
+    if (f)
+    {
+        if (fscanf(f, "%zu %zu", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return resident;
+}
+
+void test_empty_zone_release(void)
+{
+    TEST_START("Empty zones are returned to the OS");
+
+    #define RELEASE_COUNT 20000
+    static char *ptrs[RELEASE_COUNT];
+    size_t page = (size_t)getpagesize();
+
+    for (int i = 0; i < RELEASE_COUNT; i++)
+    {
+        ptrs[i] = malloc(i % 2 ? 2000 : 200);
+        TEST_ASSERT(ptrs[i] != NULL, "Allocation should succeed");
+        memset(ptrs[i], 1, i % 2 ? 2000 : 200);
+    }
+    size_t peak = resident_pages();
+
+    for (int i = 0; i < RELEASE_COUNT; i++)
+        free(ptrs[i]);
+    size_t after = resident_pages();
+
+    // ~22 MB were touched, all but a few spare zones should be gone
+    TEST_ASSERT(peak > after && (peak - after) * page > 16 * 1024 * 1024,
+                "RSS should drop once every block of a zone is free");
+
+    TEST_END();
+}
+
+#define COALESCE_SIZE 1104
+#define COALESCE_COUNT 64
+
+static void *coalesce_worker(void *arg)
+{
+    char **pair = arg;
+
+    // The thread cache is drained back to the arena when the thread exits
+    free(pair[1]);
+    free(pair[0]);
+    return NULL;
+}
+
+/* Runs in its own thread so that no cached block of the merged size exists */
+static void *coalesce_owner(void *arg)
+{
+    int *result = arg;
+    char *ptrs[COALESCE_COUNT];
+    size_t stride = ALIGN(COALESCE_SIZE + sizeof(t_block));
+    pthread_t worker;
+    int found = -1;
+
+    // Look for four blocks in a row so the middle pair has allocated
+    // neighbours on both sides
+    for (int i = 0; i < COALESCE_COUNT; i++)
+    {
+        ptrs[i] = malloc(COALESCE_SIZE);
+        if (!ptrs[i])
+            return NULL;
+        if (found < 0 && i >= 3 && (size_t)(ptrs[i] - ptrs[i - 1]) == stride
+            && (size_t)(ptrs[i - 1] - ptrs[i - 2]) == stride
+            && (size_t)(ptrs[i - 2] - ptrs[i - 3]) == stride)
+            found = i - 2;
+    }
+    result[0] = found >= 0;
+    if (found >= 0)
+    {
+        char *pair[2] = { ptrs[found], ptrs[found + 1] };
+        char *neighbour = ptrs[found + 2];
+
+        memset(neighbour, 'n', COALESCE_SIZE);
+        pthread_create(&worker, NULL, coalesce_worker, pair);
+        pthread_join(worker, NULL);
+        ptrs[found] = NULL;
+        ptrs[found + 1] = NULL;
+
+        // Both blocks were merged back into one, whatever the release order
+        char *merged = malloc(2 * stride - sizeof(t_block));
+        result[1] = merged == pair[0];
+        if (merged)
+            memset(merged, 'm', 2 * stride - sizeof(t_block));
+        result[2] = neighbour[0] == 'n' && neighbour[COALESCE_SIZE - 1] == 'n';
+        free(merged);
+    }
+    for (int i = 0; i < COALESCE_COUNT; i++)
+        free(ptrs[i]);
+    return result;
+}
+
+void test_coalesce_previous(void)
+{
+    TEST_START("Freed SMALL blocks merge with both neighbours");
+
+    int result[3] = { 0, 0, 0 };
+    pthread_t owner;
+    void *ret;
+
+    pthread_create(&owner, NULL, coalesce_owner, result);
+    pthread_join(owner, &ret);
+    TEST_ASSERT(ret != NULL, "SMALL allocations should succeed");
+    TEST_ASSERT(result[0], "Consecutive SMALL allocations should be adjacent");
+    TEST_ASSERT(result[1], "Two adjacent free blocks should be reused as one");
+    TEST_ASSERT(result[2], "Neighbour should stay intact");
+
+    TEST_END();
+}
+
+void test_large_cache(void)
+{
+    TEST_START("Freed LARGE mappings are reused");
+
+    char *first = malloc(256 * 1024);
+    TEST_ASSERT(first != NULL, "LARGE allocation should succeed");
+    memset(first, 'a', 256 * 1024);
+    free(first);
+
+    // Same size range: the cached mapping comes back instead of a new mmap
+    char *second = malloc(250 * 1024);
+    TEST_ASSERT(second == first, "A cached LARGE mapping should be reused");
+    memset(second, 'b', 250 * 1024);
+    TEST_ASSERT(second[250 * 1024 - 1] == 'b', "Reused mapping should be writable");
+
+    // Much smaller requests must not pin a big mapping
+    free(second);
+    char *small = malloc(64 * 1024);
+    TEST_ASSERT(small != NULL && small != first, "A cached mapping should not serve a much smaller request");
+    free(small);
+
+    // An expired mapping is dropped on the next miss, even with no free in between
+    t_heap *heap = (t_heap *)dlsym(RTLD_DEFAULT, "g_heap");
+    TEST_ASSERT(heap != NULL, "g_heap should be reachable");
+    if (heap)
+    {
+        time_t age = heap->large_cache_age;
+        heap->large_cache_age = 0;
+        first = malloc(256 * 1024);
+        TEST_ASSERT(first != NULL, "LARGE allocation should succeed");
+        memset(first, 'c', 256 * 1024);
+        usleep(20000);
+        free(first);    // Flushes the older mappings, only this one stays
+        usleep(20000);
+        size_t munmaps = heap->stats.large_munmaps;
+        char *other = malloc(1024 * 1024);
+        TEST_ASSERT(other != NULL, "LARGE allocation should succeed");
+        memset(other, 'd', 1024 * 1024);
+        TEST_ASSERT(heap->stats.large_munmaps > munmaps, "An expired mapping should be unmapped on a cache miss");
+        heap->large_cache_age = age;
+        free(other);
+    }
+
+    TEST_END();
+}
+
+void test_realloc_in_place(void)
+{
+    TEST_START("SMALL realloc shrinks and grows in place");
+
+    char *ptr = malloc(3000);
+    TEST_ASSERT(ptr != NULL, "SMALL allocation should succeed");
+    for (int i = 0; i < 1000; i++)
+        ptr[i] = (char)(i % 251);
+
+    // Shrinking splits off the tail, which goes back to the zone
+    char *shrunk = realloc(ptr, 1000);
+    TEST_ASSERT(shrunk == ptr, "Shrinking should keep the pointer");
+
+    // Growing again absorbs the free tail that follows
+    char *grown = realloc(shrunk, 2500);
+    TEST_ASSERT(grown == ptr, "Growing into a free neighbour should keep the pointer");
+
+    int intact = 1;
+    for (int i = 0; i < 1000; i++)
+        if (grown[i] != (char)(i % 251))
+            intact = 0;
+    TEST_ASSERT(intact, "Data should be preserved across in-place resizes");
+    memset(grown, 'g', 2500);
+    free(grown);
+
+    TEST_END();
+}
+
+static int all_zero(const unsigned char *ptr, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        if (ptr[i])
+            return 0;
+    return 1;
+}
+
+void test_calloc(void)
+{
+    TEST_START("calloc returns zeroed memory");
+
+    static const size_t sizes[] = { 24, 300, 1500, 4000, 100 * 1024, 2 * 1024 * 1024 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        // Dirty a block first so calloc has to clear recycled memory
+        unsigned char *dirty = malloc(sizes[i]);
+        TEST_ASSERT(dirty != NULL, "malloc should succeed");
+        memset(dirty, 0xFF, sizes[i]);
+        free(dirty);
+
+        unsigned char *ptr = calloc(1, sizes[i]);
+        TEST_ASSERT(ptr != NULL, "calloc should succeed");
+        TEST_ASSERT(all_zero(ptr, sizes[i]), "calloc memory should be zero");
+        memset(ptr, 0xFF, sizes[i]);
+        free(ptr);
+    }
+
+    // volatile keeps the compiler from rejecting the obviously bad size
+    volatile size_t huge = (size_t)-1 / 2;
+    errno = 0;
+    TEST_ASSERT(calloc(huge, 4) == NULL && errno == ENOMEM, "calloc should reject a size overflow");
+    errno = 0;
+    TEST_ASSERT(calloc(huge, 1) == NULL && errno == ENOMEM, "calloc should set errno when too large");
+    errno = 0;
+    TEST_ASSERT(malloc(huge) == NULL && errno == ENOMEM, "malloc should set errno when too large");
+
+    TEST_END();
+}
+
+void test_aligned_alloc(void)
+{
+    TEST_START("Aligned allocation family");
+
+    static const size_t alignments[] = { 32, 64, 256, 4096, 65536 };
+    static const size_t sizes[] = { 8, 100, 500, 3000, 20000, 300000 };
+    size_t page = (size_t)getpagesize();
+
+    for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); a++)
+    {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            void *ptr = NULL;
+            int ret = posix_memalign(&ptr, alignments[a], sizes[s]);
+            TEST_ASSERT(ret == 0 && ptr != NULL, "posix_memalign should succeed");
+            TEST_ASSERT(((uintptr_t)ptr & (alignments[a] - 1)) == 0, "Pointer should be aligned");
+            memset(ptr, 'x', sizes[s]);
+
+            // realloc and free must accept aligned blocks
+            char *grown = realloc(ptr, sizes[s] * 2);
+            TEST_ASSERT(grown != NULL && grown[sizes[s] - 1] == 'x', "realloc should keep the data");
+            free(grown);
+        }
+    }
+
+    char *p = aligned_alloc(64, 640);
+    TEST_ASSERT(p && ((uintptr_t)p & 63) == 0, "aligned_alloc should honour the alignment");
+    free(p);
+    p = memalign(128, 1000);
+    TEST_ASSERT(p && ((uintptr_t)p & 127) == 0, "memalign should honour the alignment");
+    free(p);
+    p = valloc(100);
+    TEST_ASSERT(p && ((uintptr_t)p & (page - 1)) == 0, "valloc should return a page");
+    free(p);
+
+    void *bad = NULL;
+    TEST_ASSERT(posix_memalign(&bad, 24, 100) == EINVAL, "posix_memalign should reject a bad alignment");
+
+    TEST_END();
+}
+
+void test_usable_size_and_sized_free(void)
+{
+    TEST_START("malloc_usable_size and sized free");
+
+    static const size_t sizes[] = { 1, 17, 200, 600, 3000, 5000, 100000 };
+    // Not every libc declares the C23 entry points: look them up at run time
+    void (*sized)(void *, size_t) = (void (*)(void *, size_t))dlsym(RTLD_DEFAULT, "free_sized");
+    void (*aligned_sized)(void *, size_t, size_t)
+        = (void (*)(void *, size_t, size_t))dlsym(RTLD_DEFAULT, "free_aligned_sized");
+
+    TEST_ASSERT(sized && aligned_sized, "free_sized and free_aligned_sized should be exported");
+    TEST_ASSERT(malloc_usable_size(NULL) == 0, "NULL has no usable size");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        char *ptr = malloc(sizes[i]);
+        size_t usable = malloc_usable_size(ptr);
+        TEST_ASSERT(ptr && usable >= sizes[i], "Usable size should cover the request");
+
+        // The slack belongs to the caller
+        memset(ptr, 'u', usable);
+        if (sized)
+            sized(ptr, sizes[i]);
+
+        void *aligned = NULL;
+        TEST_ASSERT(posix_memalign(&aligned, 64, sizes[i]) == 0, "posix_memalign should succeed");
+        TEST_ASSERT(malloc_usable_size(aligned) >= sizes[i], "Aligned blocks report their size too");
+        if (aligned_sized)
+            aligned_sized(aligned, 64, sizes[i]);
+    }
+
+    // Every sized free releases its block, a LARGE block shrunk to a SMALL
+    // size included: realloc moves it out of its mapping
+    void (*get_stats)(t_malloc_stats *)
+        = (void (*)(t_malloc_stats *))dlsym(RTLD_DEFAULT, "malloc_get_stats");
+    t_malloc_stats before;
+    t_malloc_stats after;
+    TEST_ASSERT(get_stats != NULL, "malloc_get_stats should be exported");
+    char *shrunk = realloc(malloc(100000), 1000);
+    TEST_ASSERT(shrunk && malloc_usable_size(shrunk) <= SMALL_MAX, "A LARGE block shrunk to a SMALL size should move");
+    shrunk[999] = 's';
+    char *blocks[4] = { malloc(24), malloc(400), malloc(1000), malloc(4000) };
+    static const size_t block_sizes[4] = { 24, 400, 1000, 4000 };
+    for (int i = 0; i < 4; i++)
+        blocks[i][0] = 'b';
+    get_stats(&before);
+    for (int i = 0; i < 4; i++)
+        sized(blocks[i], block_sizes[i]);
+    sized(shrunk, 1000);
+    get_stats(&after);
+    TEST_ASSERT(after.frees - before.frees == 5, "Each sized free should release its block");
+
+    TEST_END();
+}
+
+#define PIPE_SLOTS 1024
+#define PIPE_ITEMS 200000
+
+typedef struct s_pipe {
+    char            *slots[PIPE_SLOTS];
+    size_t          head;           // Written by the producer
+    size_t          tail;           // Written by the consumer
+    int             corrupted;
+} t_pipe;
+
+static void *pipe_producer(void *arg)
+{
+    t_pipe *pipe = arg;
+
+    for (size_t i = 0; i < PIPE_ITEMS; i++)
+    {
+        size_t size = 16 + (i * 131) % 3000;
+        char *item = malloc(size);
+        if (!item)
+            break;
+        memset(item, (int)(i & 0xFF), size);
+        while (__atomic_load_n(&pipe->head, __ATOMIC_RELAXED)
+               - __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) == PIPE_SLOTS)
+            sched_yield();
+        pipe->slots[i % PIPE_SLOTS] = item;
+        __atomic_store_n(&pipe->head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *pipe_consumer(void *arg)
+{
+    t_pipe *pipe = arg;
+
+    for (size_t i = 0; i < PIPE_ITEMS; i++)
+    {
+        while (__atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == i)
+            sched_yield();
+        char *item = pipe->slots[i % PIPE_SLOTS];
+        size_t size = 16 + (i * 131) % 3000;
+        if (item[0] != (char)(i & 0xFF) || item[size - 1] != (char)(i & 0xFF))
+            pipe->corrupted = 1;
+        free(item);
+        __atomic_store_n(&pipe->tail, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void test_remote_free_pipeline(void)
+{
+    TEST_START("Producer/consumer frees return to the producer");
+
+    static t_pipe pipe;
+    pthread_t producer, consumer;
+    size_t page = (size_t)getpagesize();
+    size_t before = resident_pages();
+
+    pthread_create(&producer, NULL, pipe_producer, &pipe);
+    pthread_create(&consumer, NULL, pipe_consumer, &pipe);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    size_t after = resident_pages();
+
+    TEST_ASSERT(pipe.tail == PIPE_ITEMS, "Every item should go through the pipeline");
+    TEST_ASSERT(!pipe.corrupted, "Items should arrive intact");
+    // ~300 MB go through the pipe, at most a few thousand blocks are live
+    TEST_ASSERT(after < before || (after - before) * page < 64 * 1024 * 1024,
+                "Freed blocks should be reused by the producer");
+
+    TEST_END();
+}
+
+static size_t count_mappings(void)
+{
+    char buf[4096];
+    size_t count = 0;
+    ssize_t got;
+    int fd = open("/proc/self/maps", O_RDONLY);
+
+    if (fd < 0)
+        return 0;
+    while ((got = read(fd, buf, sizeof(buf))) > 0)
+        for (ssize_t i = 0; i < got; i++)
+            count += buf[i] == '\n';
+    close(fd);
+    return count;
+}
+
+#define VMA_BLOCKS 6000
+
+void test_reserved_range(void)
+{
+    TEST_START("Zones stay in a few mappings");
+
+    static char *blocks[VMA_BLOCKS];
+    size_t before = count_mappings();
+    size_t peak = 0;
+    int ok = 1;
+
+    // ~12 MB of SMALL blocks, several chunks, grown and dropped a few times
+    for (int round = 0; round < 4; round++)
+    {
+        for (size_t i = 0; i < VMA_BLOCKS; i++)
+        {
+            blocks[i] = malloc(1000 + (i * 37) % 2000);
+            if (!blocks[i])
+                ok = 0;
+        }
+        size_t now = count_mappings();
+        if (now > peak)
+            peak = now;
+        for (size_t i = 0; i < VMA_BLOCKS; i += 2)
+            free(blocks[i]);
+        for (size_t i = 1; i < VMA_BLOCKS; i += 2)
+            free(blocks[i]);
+    }
+
+    TEST_ASSERT(ok, "Every allocation should succeed");
+    TEST_ASSERT(before > 0, "The mappings should be readable");
+    TEST_ASSERT(peak <= before + 8, "Chunks should not add a mapping each");
+
+    TEST_END();
+}
+
+#define KERNEL_BIG (MEMOPS_STREAM_MIN + 200)
+
+void test_copy_kernels(void)
+{
+    TEST_START("Vectorized copy and fill");
+
+    // The kernels are internal: reach them through the preloaded library
+    void *(*copy)(void *, const void *, size_t)
+        = (void *(*)(void *, const void *, size_t))dlsym(RTLD_DEFAULT, "ft_memcpy");
+    void *(*fill)(void *, int, size_t)
+        = (void *(*)(void *, int, size_t))dlsym(RTLD_DEFAULT, "ft_memset");
+    unsigned char *src = malloc(KERNEL_BIG + 64);
+    unsigned char *dst = malloc(KERNEL_BIG + 64);
+    static const size_t big[] = { 4000, MEMOPS_STREAM_MIN, KERNEL_BIG };
+    int ok = 1;
+
+    TEST_ASSERT(copy && fill, "ft_memcpy and ft_memset should be exported");
+    TEST_ASSERT(src && dst, "Buffers should be allocated");
+    if (!copy || !fill || !src || !dst)
+    {
+        TEST_END();
+        return;
+    }
+    for (size_t i = 0; i < KERNEL_BIG + 64; i++)
+        src[i] = (unsigned char)(i * 7 + 1);
+
+    // Every short length at every misalignment, then a few long ones
+    for (size_t n = 0; n < 160 + 3; n++)
+    {
+        size_t len = n < 160 ? n : big[n - 160];
+
+        for (size_t off = 0; off < 32; off += n < 160 ? 1 : 13)
+        {
+            memset(dst, 0, len + 64);
+            copy(dst + off, src + 3, len);
+            ok &= memcmp(dst + off, src + 3, len) == 0;
+            ok &= dst[off + len] == 0 && (off == 0 || dst[off - 1] == 0);
+
+            fill(dst + off, 0x5A, len);
+            for (size_t i = 0; i < len; i++)
+                ok &= dst[off + i] == 0x5A;
+            ok &= dst[off + len] == 0;
+        }
+    }
+    TEST_ASSERT(ok, "Copies and fills should cover exactly the requested bytes");
+
+    free(src);
+    free(dst);
+    TEST_END();
+}
+
+void test_stats_api(void)
+{
+    TEST_START("Statistics API");
+
+    void (*get_stats)(t_malloc_stats *)
+        = (void (*)(t_malloc_stats *))dlsym(RTLD_DEFAULT, "malloc_get_stats");
+    static t_malloc_stats before;
+    static t_malloc_stats during;
+    static t_malloc_stats after;
+    char *tiny[50];
+    char *small[10];
+    char *large;
+
+    TEST_ASSERT(get_stats != NULL, "malloc_get_stats should be exported");
+    if (!get_stats)
+    {
+        TEST_END();
+        return;
+    }
+
+    get_stats(&before);
+    for (int i = 0; i < 50; i++)
+        tiny[i] = malloc(100);
+    for (int i = 0; i < 10; i++)
+        small[i] = malloc(2000);
+    large = malloc(200000);
+    TEST_ASSERT(large != NULL, "LARGE allocation should succeed");
+    large[0] = 'x';
+    get_stats(&during);
+
+    size_t tiny_class = 0;
+    while (during.classes[tiny_class].size < 100)
+        tiny_class++;
+    size_t small_class = TINY_CLASSES + (2000 - 1) / STAT_SMALL_STEP;
+    TEST_ASSERT(during.classes[tiny_class].allocs - before.classes[tiny_class].allocs == 50,
+                "Each TINY allocation should be counted in its class");
+    TEST_ASSERT(during.classes[small_class].allocs - before.classes[small_class].allocs == 10,
+                "Each SMALL allocation should be counted in its range");
+    TEST_ASSERT(during.classes[STAT_LARGE_CLASS].allocs - before.classes[STAT_LARGE_CLASS].allocs == 1,
+                "The LARGE allocation should be counted");
+    TEST_ASSERT(during.bytes_in_use - before.bytes_in_use >= 50 * 100 + 10 * 2000 + 200000,
+                "Bytes in use should cover the new blocks");
+    TEST_ASSERT(during.large_mapped >= 200000 && during.bytes_mapped >= during.large_mapped,
+                "Mapped bytes should include the LARGE mapping");
+    TEST_ASSERT(during.metadata > 0, "Metadata should be accounted");
+
+    struct mallinfo2 info = mallinfo2();
+    TEST_ASSERT(info.hblkhd >= 200000 && info.hblks >= 1, "mallinfo2 should report the LARGE block");
+    TEST_ASSERT(info.uordblks >= 50 * 100 + 10 * 2000, "mallinfo2 should report TINY/SMALL bytes in use");
+
+    for (int i = 0; i < 50; i++)
+        free(tiny[i]);
+    for (int i = 0; i < 10; i++)
+        free(small[i]);
+    free(large);
+    get_stats(&after);
+
+    TEST_ASSERT(after.frees - during.frees == 61, "Every free should be counted");
+    TEST_ASSERT(after.bytes_in_use == before.bytes_in_use, "Bytes in use should come back");
+
+    TEST_END();
+}
+
+#define PROFILE_TEST_BLOCKS 2000
+
+void test_heap_profile(void)
+{
+    TEST_START("Sampling heap profiler");
+
+    void (*set_rate)(size_t) = (void (*)(size_t))dlsym(RTLD_DEFAULT, "malloc_profile_set_rate");
+    int (*dump)(const char *) = (int (*)(const char *))dlsym(RTLD_DEFAULT, "malloc_profile_dump");
+    static char *blocks[PROFILE_TEST_BLOCKS];
+    char path[] = "/tmp/malloc_profile_XXXXXX";
+    char head[256];
+    int fd;
+
+    TEST_ASSERT(set_rate && dump, "The profiler API should be exported");
+    if (!set_rate || !dump || (fd = mkstemp(path)) < 0)
+    {
+        TEST_END();
+        return;
+    }
+    close(fd);
+
+    // ~2 MB at a 4 KiB mean interval: hundreds of samples, half kept
+    set_rate(4096);
+    for (int i = 0; i < PROFILE_TEST_BLOCKS; i++)
+    {
+        blocks[i] = malloc(i % 3 ? 300 : 3000);
+        blocks[i][0] = 'p';
+    }
+    for (int i = 0; i < PROFILE_TEST_BLOCKS; i += 2)
+        free(blocks[i]);
+    TEST_ASSERT(dump(path) == 0, "The profile should be written");
+    set_rate(0);
+
+    fd = open(path, O_RDONLY);
+    ssize_t got = fd >= 0 ? read(fd, head, sizeof(head) - 1) : -1;
+    head[got > 0 ? got : 0] = '\0';
+    if (fd >= 0)
+        close(fd);
+    unlink(path);
+
+    size_t live = 0;
+    size_t total = 0;
+    TEST_ASSERT(sscanf(head, "heap profile: %zu: %*u [%zu:", &live, &total) == 2,
+                "The profile should start with a heap_v2 header");
+    TEST_ASSERT(strstr(head, "@ heap_v2/4096") != NULL, "The header should carry the sampling rate");
+    TEST_ASSERT(total > 100 && live > 0 && live < total, "Freed samples should leave the in-use profile");
+
+    for (int i = 1; i < PROFILE_TEST_BLOCKS; i += 2)
+        free(blocks[i]);
+
+    // A failed write must still close the profile file
+    int before = dup(0);
+    close(before);
+    TEST_ASSERT(dump("/dev/full") == -1, "A failed write should be reported");
+    int after = dup(0);
+    close(after);
+    TEST_ASSERT(after == before, "A failed dump should not leak its file descriptor");
+
+    TEST_END();
+}
+
+static uint64_t trace_varint(const uint8_t **p)
+{
+    uint64_t v = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t byte = *(*p)++;
+
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return v;
+}
+
+static uintptr_t trace_ptr(const uint8_t **p, uintptr_t *last)
+{
+    uint64_t z = trace_varint(p);
+
+    *last += (uintptr_t)((int64_t)(z >> 1) ^ -(int64_t)(z & 1));
+    return *last;
+}
+
+void test_trace_recording(void)
+{
+    TEST_START("Allocation trace recording");
+
+    int (*start)(const char *) = (int (*)(const char *))dlsym(RTLD_DEFAULT, "malloc_trace_start");
+    void (*stop)(void) = (void (*)(void))dlsym(RTLD_DEFAULT, "malloc_trace_stop");
+    char path[] = "/tmp/malloc_trace_XXXXXX";
+    static uint8_t data[1 << 16];
+    int fd;
+
+    TEST_ASSERT(start && stop, "The trace API should be exported");
+    if (!start || !stop || (fd = mkstemp(path)) < 0)
+    {
+        TEST_END();
+        return;
+    }
+    close(fd);
+
+    TEST_ASSERT(start(path) == 0, "The trace should start");
+    TEST_ASSERT(start(path) == -1, "A second trace should be refused");
+    char *ptr = malloc(100);
+    ptr[0] = 't';
+    ptr = realloc(ptr, 5000);
+    ptr[4999] = 't';
+    free(ptr);
+    stop();
+    char *untraced = malloc(100);
+    untraced[0] = 'u';
+    free(untraced);
+
+    fd = open(path, O_RDONLY);
+    ssize_t len = fd >= 0 ? read(fd, data, sizeof(data)) : -1;
+    if (fd >= 0)
+        close(fd);
+    unlink(path);
+    TEST_ASSERT(len >= (ssize_t)sizeof(t_trace_header) && !memcmp(data, TRACE_MAGIC, 8),
+                "The file should start with the trace header");
+
+    // Find malloc(100) -> realloc(5000) -> free on the same pointers
+    int step = 0;
+    size_t events = 0;
+    uintptr_t block = 0;
+    uintptr_t last_ptr[64] = {0};
+    const uint8_t *p = data + sizeof(t_trace_header);
+    while (len > 0 && p + sizeof(t_trace_chunk) <= data + len)
+    {
+        t_trace_chunk chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        p += sizeof(chunk);
+        const uint8_t *end = p + chunk.length;
+        uintptr_t *last = &last_ptr[chunk.thread % 64];
+
+        while (p < end)
+        {
+            int op = *p & ~TRACE_NULL;
+            bool null = *p++ & TRACE_NULL;
+            uintptr_t in = 0;
+            uintptr_t out = 0;
+            size_t size = 0;
+
+            trace_varint(&p);
+            if (op == TRACE_FREE || op == TRACE_REALLOC)
+                in = trace_ptr(&p, last);
+            if (op != TRACE_FREE)
+            {
+                size = trace_varint(&p);
+                if (op == TRACE_ALIGNED || op == TRACE_REALLOC)
+                    trace_varint(&p);
+                if (!null)
+                    out = trace_ptr(&p, last);
+            }
+            events++;
+            if (step == 0 && op == TRACE_MALLOC && size == 100)
+                block = out, step = 1;
+            else if (step == 1 && op == TRACE_REALLOC && in == block && size == 5000)
+                block = out, step = 2;
+            else if (step == 2 && op == TRACE_FREE && in == block)
+                step = 3;
+        }
+    }
+    TEST_ASSERT(step == 3, "malloc, realloc and free should be recorded in order");
+    TEST_ASSERT(events == 3, "realloc should be one event and nothing after the stop");
+
+    TEST_END();
+}
+
+#define ZONE_TEST_BLOCKS 64
+
+void test_zone_info(void)
+{
+    TEST_START("Per-zone fragmentation report");
+
+    size_t (*zone_info)(t_zone_info *, size_t) =
+        (size_t (*)(t_zone_info *, size_t))dlsym(RTLD_DEFAULT, "malloc_zone_info");
+    static t_zone_info zones[4096];
+    char *blocks[ZONE_TEST_BLOCKS];
+
+    TEST_ASSERT(zone_info != NULL, "malloc_zone_info() should be exported");
+    if (!zone_info)
+    {
+        TEST_END();
+        return;
+    }
+
+    // Free every other SMALL block: holes no bigger than one block
+    for (int i = 0; i < ZONE_TEST_BLOCKS; i++)
+    {
+        blocks[i] = malloc(2000);
+        blocks[i][0] = 'z';
+    }
+    for (int i = 0; i < ZONE_TEST_BLOCKS; i += 2)
+        free(blocks[i]);
+    char *tiny = malloc(24);
+    tiny[0] = 'z';
+
+    size_t count = zone_info(zones, 4096);
+    size_t n = count < 4096 ? count : 4096;
+    bool consistent = true;
+    bool found_small = false;
+    bool found_tiny = false;
+
+    TEST_ASSERT(count > 0 && count == zone_info(NULL, 0), "The zone count should not depend on max");
+    for (size_t i = 0; i < n; i++)
+    {
+        t_zone_info *z = &zones[i];
+
+        if (z->largest_free > z->free_bytes || z->used_bytes + z->free_bytes > z->size)
+            consistent = false;
+        if (z->kind == PAGE_SMALL && (char *)blocks[1] > (char *)z->start
+            && (char *)blocks[1] < (char *)z->start + z->size)
+            found_small = z->used_bytes >= 2000 && z->largest_free >= 2000;
+        if (z->kind == PAGE_TINY && tiny > (char *)z->start && tiny < (char *)z->start + z->size)
+            found_tiny = z->slot_size >= 24 && z->used_bytes >= z->slot_size;
+    }
+    TEST_ASSERT(consistent, "Free and used bytes should fit in each zone");
+    TEST_ASSERT(found_small, "The SMALL zone should report the held blocks and the holes");
+    TEST_ASSERT(found_tiny, "The TINY slab should report its slot size");
+
+    for (int i = 1; i < ZONE_TEST_BLOCKS; i += 2)
+        free(blocks[i]);
+    free(tiny);
+
+    TEST_END();
+}
+
+#define SCRIBBLE_FILLERS 2048
+
+void test_scribble_grow_calloc(void)
+{
+    TEST_START("calloc after a scribbled in-place grow");
+
+    t_heap *heap = (t_heap *)dlsym(RTLD_DEFAULT, "g_heap");
+    static char *fillers[SCRIBBLE_FILLERS];
+    size_t count = 0;
+    char *block = NULL;
+
+    TEST_ASSERT(heap != NULL, "g_heap should be exported");
+
+    // Fill SMALL space until a block opens an empty zone: the rest of the
+    // zone is then the only free block that fits these sizes
+    while (count < SCRIBBLE_FILLERS && !block)
+    {
+        char *ptr = malloc(4000);
+        uintptr_t zone = (uintptr_t)ptr & ~(uintptr_t)(SMALL_ZONE_SIZE - 1);
+        t_block *next = (t_block *)((uintptr_t)ptr - sizeof(t_block) + BLOCK_SIZE(4000));
+
+        ptr[0] = 'f';
+        if (ptr == (char *)zone + ALIGN(sizeof(t_zone)) + 2 * sizeof(t_block)
+            && next->is_free && next->size > (size_t)SMALL_ZONE_SIZE / 2)
+            block = ptr;
+        else
+            fillers[count++] = ptr;
+    }
+    TEST_ASSERT(block != NULL, "A block should open an empty SMALL zone");
+
+    // Grow into the free remainder with scribbling on, then take what is left
+    uintptr_t before = (uintptr_t)block;
+    bool scribble = heap->debug.scribble;
+    heap->debug.scribble = true;
+    block = realloc(block, 4090);
+    heap->debug.scribble = scribble;
+    TEST_ASSERT((uintptr_t)block == before, "realloc should grow the block in place");
+
+    unsigned char *rest = calloc(1, 4000);
+    bool zeroed = rest != NULL;
+    for (size_t i = 0; zeroed && i < 4000; i++)
+        zeroed = rest[i] == 0;
+    TEST_ASSERT(rest == (unsigned char *)block + BLOCK_SIZE(4090),
+                "calloc should be served from the remainder of the grown block");
+    TEST_ASSERT(zeroed, "calloc should return zeros from the scribbled remainder");
+
+    free(rest);
+    free(block);
+    for (size_t i = 0; i < count; i++)
+        free(fillers[i]);
+
+    TEST_END();
+}
+
+/* Sized frees with MALLOC_CHECK_=1, returns how many mismatches were reported */
+static int sized_free_reports(t_heap *heap, void (*sized)(void *, size_t), void **ptrs, size_t *sizes, int count)
+{
+    char buf[4096];
+    int fds[2];
+    int level = heap->debug.check_level;
+    int saved = dup(2);
+    int reports = 0;
+    ssize_t len;
+
+    if (saved < 0 || pipe(fds) != 0)
+        return -1;
+    dup2(fds[1], 2);
+    close(fds[1]);
+    heap->debug.check_level = 1;
+    for (int i = 0; i < count; i++)
+        sized(ptrs[i], sizes[i]);
+    heap->debug.check_level = level;
+    dup2(saved, 2);
+    close(saved);
+
+    while ((len = read(fds[0], buf, sizeof(buf) - 1)) > 0)
+    {
+        buf[len] = '\0';
+        for (char *line = strstr(buf, "free_sized()"); line; line = strstr(line + 1, "free_sized()"))
+            reports++;
+    }
+    close(fds[0]);
+    return reports;
+}
+
+void test_sized_free_check(void)
+{
+    TEST_START("MALLOC_CHECK_ cross-check of sized frees");
+
+    t_heap *heap = (t_heap *)dlsym(RTLD_DEFAULT, "g_heap");
+    void (*sized)(void *, size_t) = (void (*)(void *, size_t))dlsym(RTLD_DEFAULT, "free_sized");
+    void *ptrs[6];
+    size_t sizes[6];
+
+    TEST_ASSERT(heap && sized, "g_heap and free_sized should be exported");
+
+    // The size each block was requested with, shrunk blocks included
+    ptrs[0] = malloc(1);
+    ptrs[1] = malloc(200);
+    ptrs[2] = realloc(malloc(500), 100);
+    ptrs[3] = malloc(4000);
+    ptrs[4] = realloc(malloc(3000), 600);
+    ptrs[5] = malloc(100000);
+    sizes[0] = 1;
+    sizes[1] = 200;
+    sizes[2] = 100;
+    sizes[3] = 4000;
+    sizes[4] = 600;
+    sizes[5] = 100000;
+    TEST_ASSERT(sized_free_reports(heap, sized, ptrs, sizes, 6) == 0,
+                "Matching sizes should not be reported");
+
+    // Smaller than the request, in every kind of block, and zero
+    ptrs[0] = malloc(200);
+    ptrs[1] = malloc(4000);
+    ptrs[2] = malloc(4000);
+    ptrs[3] = malloc(100000);
+    ptrs[4] = malloc(100000);
+    ptrs[5] = malloc(16);
+    sizes[0] = 16;
+    sizes[1] = 1;
+    sizes[2] = 3900;
+    sizes[3] = 50000;
+    sizes[4] = 200000;
+    sizes[5] = 0;
+    TEST_ASSERT(sized_free_reports(heap, sized, ptrs, sizes, 6) == 6,
+                "Each wrong size should be reported");
+
+    TEST_END();
+}
+
+#define CHUNK_TEST_ZONES 512
+
+/* Sum the AnonHugePages of a made-up smaps listing */
+static size_t fake_smaps_thp(size_t (*thp)(int), const char *listing)
+{
+    char path[] = "/tmp/ft_malloc_smapsXXXXXX";
+    int fd = mkstemp(path);
+    size_t total;
+
+    if (fd < 0)
+        return (size_t)-1;
+    unlink(path);
+    if (write(fd, listing, strlen(listing)) != (ssize_t)strlen(listing) || lseek(fd, 0, SEEK_SET) != 0)
+    {
+        close(fd);
+        return (size_t)-1;
+    }
+    total = thp(fd);
+    close(fd);
+    return total;
+}
+
+void test_chunk_backend(void)
+{
+    TEST_START("Hugepage chunk packing, purging and THP report");
+
+    t_heap *heap = (t_heap *)dlsym(RTLD_DEFAULT, "g_heap");
+    void *(*map)(size_t, bool *) = (void *(*)(size_t, bool *))dlsym(RTLD_DEFAULT, "zone_map");
+    void (*unmap)(void *, size_t) = (void (*)(void *, size_t))dlsym(RTLD_DEFAULT, "zone_unmap");
+    size_t (*thp)(int) = (size_t (*)(int))dlsym(RTLD_DEFAULT, "smaps_thp_bytes");
+    size_t (*chunk_thp)(void) = (size_t (*)(void))dlsym(RTLD_DEFAULT, "chunk_thp_bytes");
+    void (*get_stats)(t_malloc_stats *)
+        = (void (*)(t_malloc_stats *))dlsym(RTLD_DEFAULT, "malloc_get_stats");
+    static void *others[CHUNK_TEST_ZONES];
+    void *zones[CHUNK_MAX_UNITS];
+    size_t zone_size = SMALL_ZONE_SIZE;
+    size_t count = 0;
+    size_t packed = 0;
+    t_chunk *chunk = NULL;
+    bool zeroed;
+
+    TEST_ASSERT(heap && map && unmap && thp && chunk_thp && get_stats, "The zone backend should be exported");
+    if (!heap->hugepages)
+    {
+        TEST_END();
+        return;
+    }
+
+    // Map zones until one opens an empty chunk: no other chunk has room left
+    while (!chunk && count < CHUNK_TEST_ZONES)
+    {
+        void *zone = map(zone_size, &zeroed);
+        t_chunk *owner = (t_chunk *)((uintptr_t)zone & ~(CHUNK_SIZE - 1));
+
+        if (zone && owner->used_units == zone_size / CHUNK_UNIT)
+        {
+            chunk = owner;
+            zones[packed++] = zone;
+        }
+        else
+            others[count++] = zone;
+    }
+    TEST_ASSERT(chunk != NULL, "A zone should open an empty chunk");
+
+    // The next zones are packed into the same chunk until it is full
+    size_t capacity = (CHUNK_SIZE / CHUNK_UNIT - 1) / (zone_size / CHUNK_UNIT);
+    bool same_chunk = true;
+    while (packed < capacity)
+    {
+        void *zone = map(zone_size, &zeroed);
+
+        same_chunk &= (t_chunk *)((uintptr_t)zone & ~(CHUNK_SIZE - 1)) == chunk
+            && ((uintptr_t)zone & (zone_size - 1)) == 0;
+        zones[packed++] = zone;
+    }
+    TEST_ASSERT(same_chunk, "Consecutive zones should come from the same aligned chunk");
+
+    // THP-backed bytes: within what is mapped, only counted for the heap
+    t_malloc_stats stats;
+    char listing[1024];
+    int on_stack;
+    get_stats(&stats);
+    TEST_ASSERT(chunk_thp() <= stats.bytes_mapped, "THP-backed bytes should not exceed the mapped total");
+    snprintf(listing, sizeof(listing),
+             "%lx-%lx rw-p 00000000 00:00 0\nSize:               2048 kB\nRss:                 128 kB\n"
+             "%lx-%lx rw-p 00000000 00:00 0 [stack]\nAnonHugePages:      2048 kB\n",
+             (unsigned long)chunk, (unsigned long)chunk + CHUNK_SIZE,
+             (unsigned long)&on_stack & ~4095UL, ((unsigned long)&on_stack & ~4095UL) + 4096);
+    TEST_ASSERT(fake_smaps_thp(thp, listing) == 0, "A listing without AnonHugePages for the heap should report 0");
+    snprintf(listing, sizeof(listing),
+             "%lx-%lx rw-p 00000000 00:00 0\nSize:               2048 kB\nAnonHugePages:      2048 kB\n",
+             (unsigned long)chunk, (unsigned long)chunk + CHUNK_SIZE);
+    TEST_ASSERT(fake_smaps_thp(thp, listing) == CHUNK_SIZE, "AnonHugePages of a chunk should be counted");
+
+    // Freeing a few zones keeps their pages backed for the next ones
+    size_t purges = heap->stats.chunk_purges;
+    bool dirty = false;
+    for (size_t i = 0; i < 3; i++)
+        unmap(zones[--packed], zone_size);
+    for (size_t i = 0; i < CHUNK_MAX_UNITS / 64; i++)
+        dirty |= chunk->dirty[i] != 0;
+    TEST_ASSERT(heap->stats.chunk_purges == purges && dirty, "Freeing a few zones should not purge the chunk");
+
+    // Once the chunk is mostly empty, its free units are dropped
+    while (packed > 3)
+        unmap(zones[--packed], zone_size);
+    dirty = false;
+    for (size_t i = 0; i < CHUNK_MAX_UNITS / 64; i++)
+        dirty |= chunk->dirty[i] != 0;
+    TEST_ASSERT(heap->stats.chunk_purges == purges + 1 && !dirty, "Freeing most zones should purge the chunk");
+
+    while (packed > 0)
+        unmap(zones[--packed], zone_size);
+    for (size_t i = 0; i < count; i++)
+        unmap(others[i], zone_size);
+
+    TEST_END();
+}
+
+#define MALLINFO_TEST_BLOCKS 2000
+
+typedef struct s_mallinfo_race {
+    void    *slot;          // LARGE block handed from the producer to main
+    int     done;
+    size_t  max_hblks;
+    size_t  max_uordblks;
+} t_mallinfo_race;
+
+/* Allocates LARGE blocks that the main thread frees */
+static void *mallinfo_producer(void *arg)
+{
+    t_mallinfo_race *race = (t_mallinfo_race *)arg;
+
+    for (int i = 0; i < MALLINFO_TEST_BLOCKS; i++)
+    {
+        void *ptr = malloc(200000);
+        void *empty = NULL;
+
+        while (!__atomic_compare_exchange_n(&race->slot, &empty, ptr, false,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            empty = NULL;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Reads mallinfo2() while the frees race with the allocations */
+static void *mallinfo_reader(void *arg)
+{
+    t_mallinfo_race *race = (t_mallinfo_race *)arg;
+
+    while (!__atomic_load_n(&race->done, __ATOMIC_ACQUIRE))
+    {
+        struct mallinfo2 info = mallinfo2();
+
+        if (info.hblks > race->max_hblks)
+            race->max_hblks = info.hblks;
+        if (info.uordblks > race->max_uordblks)
+            race->max_uordblks = info.uordblks;
+        sched_yield();
+    }
+    return NULL;
+}
+
+void test_mallinfo_cross_thread(void)
+{
+    TEST_START("mallinfo2 with cross-thread LARGE frees");
+
+    t_mallinfo_race race = {0};
+    pthread_t producer;
+    pthread_t reader;
+    size_t hblks = mallinfo2().hblks;
+
+    pthread_create(&reader, NULL, mallinfo_reader, &race);
+    pthread_create(&producer, NULL, mallinfo_producer, &race);
+    for (int freed = 0; freed < MALLINFO_TEST_BLOCKS; )
+    {
+        void *ptr = __atomic_exchange_n(&race.slot, NULL, __ATOMIC_ACQUIRE);
+
+        if (ptr)
+        {
+            free(ptr);
+            freed++;
+        }
+        else
+            sched_yield();
+    }
+    pthread_join(producer, NULL);
+    __atomic_store_n(&race.done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+
+    // A free counted before its allocation must not wrap the counts
+    TEST_ASSERT(race.max_hblks <= hblks + 2, "mallinfo2 should never count more LARGE blocks than are live");
+    TEST_ASSERT(race.max_uordblks < (size_t)1 << 48, "mallinfo2 bytes in use should never wrap");
+
+    // Force what the race can show: more LARGE frees than allocations
+    void (*count_alloc)(int, size_t) = (void (*)(int, size_t))dlsym(RTLD_DEFAULT, "stats_alloc");
+    void (*count_free)(int, size_t) = (void (*)(int, size_t))dlsym(RTLD_DEFAULT, "stats_free");
+    TEST_ASSERT(count_alloc && count_free, "The stats hooks should be reachable");
+    if (count_alloc && count_free)
+    {
+        hblks = mallinfo2().hblks;
+        for (size_t i = 0; i <= hblks; i++)
+            count_free(PAGE_LARGE, (size_t)1 << 40);
+        struct mallinfo2 info = mallinfo2();
+        for (size_t i = 0; i <= hblks; i++)
+            count_alloc(PAGE_LARGE, (size_t)1 << 40);
+        TEST_ASSERT(info.hblks == 0, "Early LARGE frees should not wrap the block count");
+        TEST_ASSERT(info.uordblks < (size_t)1 << 48, "Early LARGE frees should not wrap the bytes in use");
+    }
+
+    TEST_END();
+}